@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include "../wrappers/string.h"
+#include "../column/segments.h"
 
 #include "../object.h"
 
@@ -45,70 +46,35 @@ namespace Provider {
     }
 
 /**
- * Base class containing common code for columns of all types
+ * Base class containing common code for columns of all types. Entries are kept in fixed-size
+ * segments so appending never copies the entries already stored.
  */
     class BaseColumn : public Object {
     public:
-        /** Initial arraylist capacity */
-        static const size_t DEFAULT_CAPACITY = 16;
         /** What kind of column this is */
         ColumnType _type;
-        /** Array of booleans indicating whether entry is present or missing */
-        bool *_entry_present;
+        /** Booleans indicating whether entry is present or missing */
+        SegmentArray<bool> _entry_present;
         /** Length of entries in this column */
         size_t _length;
-        /** Capacity of arrays before reallocation is necessary */
-        size_t _capacity;
 
         /**
          * Constructs a BaseColumn type.
          * @param type The type of column
-         * @param initial_capacity The initial capacity of the arraylists
          */
-        BaseColumn(ColumnType type, size_t initial_capacity) : Object() {
+        BaseColumn(ColumnType type) : Object() {
             _type = type;
-            _capacity = initial_capacity;
             _length = 0;
-            _entry_present = new bool[_capacity];
         }
 
         /** Frees this BaseColumn */
-        virtual ~BaseColumn() { delete[] _entry_present; }
+        virtual ~BaseColumn() {}
 
         /**
-         * Resizes the internal arrays if length has reached capacity.
-         */
-        virtual void _resize_if_necessary() {
-            if (_length == _capacity) {
-                size_t new_cap = _capacity * 2;
-                _resize_entries(new_cap);
-                _capacity = new_cap;
-            }
-        }
-
-        /**
-         * Resizes the entry present/missing bool array to a new size.
-         * @param new_cap the requested size
-         */
-        virtual void _resize_entry_present(size_t new_cap) {
-            bool *new_entry_present = new bool[new_cap];
-            memcpy(new_entry_present, _entry_present, _capacity * sizeof(bool));
-            delete[] _entry_present;
-            _entry_present = new_entry_present;
-        }
-
-        /**
-         * Marks a given entry as present or not present
-         * @param which The entry index
+         * Marks the next entry as present or not present
          * @param present Whether this entry is present (true) or missing (false)
          */
-        virtual void _set_entry_present(size_t which, bool present) { _entry_present[which] = present; }
-
-        /**
-         * Method to be implemented by subclasses that resizes their array of the actual entries.
-         * @param new_cap The requested size. Will always be greater than the current capacity.
-         */
-        virtual void _resize_entries(size_t new_cap) = 0;
+        virtual void _append_entry_present(bool present) { _entry_present.push_back(present); }
 
         /**
          * Appends a missing entry.
@@ -154,7 +120,7 @@ namespace Provider {
          */
         virtual bool isEntryPresent(size_t which) {
             assert(which < _length);
-            return _entry_present[which];
+            return _entry_present.get(which);
         }
     };
 
@@ -165,27 +131,16 @@ namespace Provider {
  */
     class StringColumn : public BaseColumn {
     public:
-        const char **_entries;
+        SegmentArray<const char *> _entries;
 
-        StringColumn() : BaseColumn(ColumnType::STRING, DEFAULT_CAPACITY) {
-            _entries = new const char *[_capacity];
-        }
+        StringColumn() : BaseColumn(ColumnType::STRING) {}
 
         virtual ~StringColumn() {
             for (size_t i = 0; i < _length; i++) {
-                if (_entries[i] != nullptr) {
-                    delete[] _entries[i];
+                if (_entries.get(i) != nullptr) {
+                    delete[] _entries.get(i);
                 }
             }
-            delete[] _entries;
-        }
-
-        virtual void _resize_entries(size_t new_cap) {
-            _resize_entry_present(new_cap);
-            const char **new_entries = new const char *[new_cap];
-            memcpy(new_entries, _entries, _capacity * sizeof(char *));
-            delete[] _entries;
-            _entries = new_entries;
         }
 
         /**
@@ -195,29 +150,24 @@ namespace Provider {
          * @param entry The string. Must not be null
          */
         virtual void append(const char *entry) {
-            _resize_if_necessary();
-            _set_entry_present(_length, true);
-
-            _entries[_length] = entry;
-
+            _append_entry_present(true);
+            _entries.push_back(entry);
             _length += 1;
         }
 
         virtual void appendMissing() {
-            _resize_if_necessary();
-            _set_entry_present(_length, false);
-
-            _entries[_length] = nullptr;
+            _append_entry_present(false);
+            _entries.push_back(nullptr);
             _length += 1;
         }
 
         virtual const char *getEntry(size_t which) {
             assert(which < _length);
             assert(isEntryPresent(which));
-            return _entries[which];
+            return _entries.get(which);
         }
 
-        virtual void _printEntry(size_t which) { printf("\"%s\"\n", _entries[which]); }
+        virtual void _printEntry(size_t which) { printf("\"%s\"\n", _entries.get(which)); }
     };
 
 /**
@@ -225,45 +175,31 @@ namespace Provider {
  */
     class IntegerColumn : public BaseColumn {
     public:
-        int *_entries;
+        SegmentArray<int> _entries;
 
-        IntegerColumn() : BaseColumn(ColumnType::INTEGER, DEFAULT_CAPACITY) {
-            _entries = new int[_capacity];
-        }
+        IntegerColumn() : BaseColumn(ColumnType::INTEGER) {}
 
-        virtual ~IntegerColumn() { delete[] _entries; }
-
-        virtual void _resize_entries(size_t new_cap) {
-            _resize_entry_present(new_cap);
-            int *new_entries = new int[new_cap];
-            memcpy(new_entries, _entries, _capacity * sizeof(int));
-            delete[] _entries;
-            _entries = new_entries;
-        }
+        virtual ~IntegerColumn() {}
 
         virtual void append(int entry) {
-            _resize_if_necessary();
-            _set_entry_present(_length, true);
-
-            _entries[_length] = entry;
+            _append_entry_present(true);
+            _entries.push_back(entry);
             _length += 1;
         }
 
         virtual void appendMissing() {
-            _resize_if_necessary();
-            _set_entry_present(_length, false);
-
-            _entries[_length] = 0;
+            _append_entry_present(false);
+            _entries.push_back(0);
             _length += 1;
         }
 
         virtual int getEntry(size_t which) {
             assert(which < _length);
             assert(isEntryPresent(which));
-            return _entries[which];
+            return _entries.get(which);
         }
 
-        virtual void _printEntry(size_t which) { printf("%d\n", _entries[which]); }
+        virtual void _printEntry(size_t which) { printf("%d\n", _entries.get(which)); }
     };
 
 /**
@@ -271,45 +207,31 @@ namespace Provider {
  */
     class FloatColumn : public BaseColumn {
     public:
-        float *_entries;
+        SegmentArray<float> _entries;
 
-        FloatColumn() : BaseColumn(ColumnType::FLOAT, DEFAULT_CAPACITY) {
-            _entries = new float[_capacity];
-        }
+        FloatColumn() : BaseColumn(ColumnType::FLOAT) {}
 
-        virtual ~FloatColumn() { delete[] _entries; }
-
-        virtual void _resize_entries(size_t new_cap) {
-            _resize_entry_present(new_cap);
-            float *new_entries = new float[new_cap];
-            memcpy(new_entries, _entries, _capacity * sizeof(float));
-            delete[] _entries;
-            _entries = new_entries;
-        }
+        virtual ~FloatColumn() {}
 
         virtual void append(float entry) {
-            _resize_if_necessary();
-            _set_entry_present(_length, true);
-
-            _entries[_length] = entry;
+            _append_entry_present(true);
+            _entries.push_back(entry);
             _length += 1;
         }
 
         virtual void appendMissing() {
-            _resize_if_necessary();
-            _set_entry_present(_length, false);
-
-            _entries[_length] = 0;
+            _append_entry_present(false);
+            _entries.push_back(0);
             _length += 1;
         }
 
         virtual float getEntry(size_t which) {
             assert(which < _length);
             assert(isEntryPresent(which));
-            return _entries[which];
+            return _entries.get(which);
         }
 
-        virtual void _printEntry(size_t which) { printf("%e\n", _entries[which]); }
+        virtual void _printEntry(size_t which) { printf("%e\n", _entries.get(which)); }
     };
 
 /**
@@ -317,45 +239,31 @@ namespace Provider {
  */
     class BoolColumn : public BaseColumn {
     public:
-        bool *_entries;
-
-        BoolColumn() : BaseColumn(ColumnType::BOOL, DEFAULT_CAPACITY) {
-            _entries = new bool[_capacity];
-        }
+        SegmentArray<bool> _entries;
 
-        virtual ~BoolColumn() { delete[] _entries; }
+        BoolColumn() : BaseColumn(ColumnType::BOOL) {}
 
-        virtual void _resize_entries(size_t new_cap) {
-            _resize_entry_present(new_cap);
-            bool *new_entries = new bool[new_cap];
-            memcpy(new_entries, _entries, _capacity * sizeof(bool));
-            delete[] _entries;
-            _entries = new_entries;
-        }
+        virtual ~BoolColumn() {}
 
         virtual void append(bool entry) {
-            _resize_if_necessary();
-            _set_entry_present(_length, true);
-
-            _entries[_length] = entry;
+            _append_entry_present(true);
+            _entries.push_back(entry);
             _length += 1;
         }
 
         virtual void appendMissing() {
-            _resize_if_necessary();
-            _set_entry_present(_length, false);
-
-            _entries[_length] = 0;
+            _append_entry_present(false);
+            _entries.push_back(0);
             _length += 1;
         }
 
         virtual bool getEntry(size_t which) {
             assert(which < _length);
             assert(isEntryPresent(which));
-            return _entries[which];
+            return _entries.get(which);
         }
 
-        virtual void _printEntry(size_t which) { printf("%d\n", _entries[which]); }
+        virtual void _printEntry(size_t which) { printf("%d\n", _entries.get(which)); }
     };
 
 /**
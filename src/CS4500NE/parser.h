@@ -3,11 +3,15 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <thread>
+#include <vector>
 
 #include "column_prov.h"
 #include "../wrappers/string.h"
 #include "../dataframe/schema.h"
 #include "../dataframe/dataframe.h"
+#include "../mapped.h"
+#include "scan.h"
 
 /**
  *
@@ -97,23 +101,22 @@ public:
      */
     virtual int toInt() {
         // Roll a custom integer parsing function to avoid having to allocate a new null-terminated
-        // string for atoi and friends.
-        long result = 0;
+        // string for atoi and friends. The sign is handled once, then digits are consumed with a
+        // single unsigned comparison each.
+        const char *p = _str + _start;
+        const char *end = _str + _end;
         bool is_negative = false;
-        for (size_t i = _start; i < _end; i++) {
-            char c = _str[i];
-            if (i == _start && c == '-') {
-                is_negative = true;
-                continue;
-            } else if (i == _start && c == '+') {
-                continue;
-            } else if (c >= '0' && c <= '9') {
-                result = result * 10 + (c - '0');
-            } else {
-                break;
-            }
+        if (p < end && (*p == '-' || *p == '+')) {
+            is_negative = *p == '-';
+            p++;
         }
-        return is_negative ? -result : result;
+        unsigned long result = 0;
+        for (; p < end; p++) {
+            unsigned digit = (unsigned char) *p - '0';
+            if (digit > 9) break;
+            result = result * 10 + digit;
+        }
+        return is_negative ? -(long) result : (long) result;
     }
 
     /**
@@ -121,180 +124,86 @@ public:
      * @return The float
      */
     virtual float toFloat() {
-        // It's hard to roll a float parsing function by hand, so bite the bullet and allocate a
-        // null-terminated string for atof.
-        char *cstr = toCString();
-        float result = atof(cstr);
-        delete[] cstr;
-        return result;
+        // It's hard to roll a float parsing function by hand, so null-terminate a copy for atof,
+        // on the stack unless the field is unusually long.
+        char buf[64];
+        size_t length = _end - _start;
+        if (length >= sizeof(buf)) {
+            char *cstr = toCString();
+            float result = atof(cstr);
+            delete[] cstr;
+            return result;
+        }
+        memcpy(buf, getChars(), length);
+        buf[length] = '\0';
+        return atof(buf);
     }
 };
 
 /**
- * This class is capable of reading a given file line-by-line in a semi-efficient manner.
- * Additionally, it can be constrained to a given start and end position in the file, and will
- * discard the first and last (possibly partial) lines in this case.
+ * This class reads the lines of a file mapped in memory, handing out views of them without
+ * copying. Additionally, it can be constrained to a given start and end position in the file, and
+ * will discard the first and last (possibly partial) lines in this case, unless it is told the
+ * positions are aligned on line starts.
  */
 class LineReader : public Object {
 public:
-    /** Temporary buffer for file contents */
-    char _buf[4096];
-    size_t _buf_length;
-    /** Current position in buffer */
+    /** The mapped bytes of the file, external */
+    const char *_data;
+    /** Current position in the file */
     size_t _pos;
-    /** The file we're reading from */
-    FILE *_file;
     /** Byte indices for start, end, and total file size */
     size_t _file_start;
     size_t _file_end;
     size_t _file_size;
-    /** Heap-allocated current line being built by readLine() */
-    char *_current_line;
-    size_t _current_line_size;
-    /** Total number of bytes read so far */
-    size_t _read_size;
+    /** Do _file_start and _file_end fall on line starts, no line is then partial */
+    bool _aligned;
 
     /**
      * Constructs a new LineReader.
-     * @param file The file to read from.
+     * @param data The bytes of the file, e.g. a MappedFile. Must outlive the reader
      * @param file_start the starting index (of bytes in the file)
      * @param file_end The ending index
-     * @param file_size The total size of the file (as obtained by e.g. ftell)
+     * @param file_size The total size of the file
+     * @param aligned Whether file_start and file_end are line starts (or the file bounds)
      */
-    LineReader(FILE *file, size_t file_start, size_t file_end, size_t file_size) : Object() {
-        assert(file != nullptr);
-        _file = file;
+    LineReader(const char *data, size_t file_start, size_t file_end, size_t file_size,
+               bool aligned = false) : Object() {
+        assert(data != nullptr || file_size == 0);
+        _data = data;
+        _aligned = aligned;
         _file_start = file_start;
         _file_end = file_end;
         _file_size = file_size;
-        fseek(file, file_start, SEEK_SET);
-        _current_line = nullptr;
-        _current_line_size = 0;
-        _pos = 0;
-        _buf_length = 0;
-        _read_size = 0;
-    }
-
-    /**
-     * Destructor for LineReader
-     */
-    virtual ~LineReader() {
-        if (_current_line != nullptr) {
-            delete[] _current_line;
-        }
+        reset();
     }
 
     /**
-     * Null-terminates the current line being built and returns it, setting the _current_line
-     * member to null. Ownership of the line is transferred to the caller.
-     * @return A new null terminated string for the completed line
-     */
-    virtual char *_get_current_line() {
-        if (_current_line == nullptr) {
-            return nullptr;
-        }
-
-        char *line = _current_line;
-        line[_current_line_size] = '\0';
-        _current_line_size = 0;
-        _current_line = nullptr;
-        return line;
-    }
-
-    /**
-     * Appends a given section of the given string to the _current_line member.
-     * @param src The string to use
-     * @param start The starting index in the string to copy from
-     * @param end The ending index in the string to copy up to
-     */
-    virtual void _append_current_line(const char *src, size_t start, size_t end) {
-        char *new_line;
-        size_t copy_pos;
-        if (_current_line == nullptr) {
-            // Allocated a new heap buffer for the line
-            new_line = new char[(end - start) + 1];
-            _current_line_size = (end - start);
-            copy_pos = 0;
-        } else {
-            // Expand the existing buffer
-            new_line = new char[_current_line_size + (end - start) + 1];
-            memcpy(new_line, _current_line, _current_line_size);
-            copy_pos = _current_line_size;
-            _current_line_size += (end - start);
-            delete[] _current_line;
-        }
-
-        memcpy(&new_line[copy_pos], &src[start], end - start);
-        _current_line = new_line;
-    }
-
-    /**
-     * The main method implemented by this type. Reads the next full line out of the file. If
+     * The main method implemented by this type. Finds the next full line in the file. If
      * starting from a nonzero offset or ending before the end of the file, the first and last
      * lines respectively are skipped.
-     * @return The next line, or nullptr if we are out of lines
+     * @param len Set to the length of the line, without its newline
+     * @return The chars of the next line, not null-terminated and owned by the file, or nullptr
+     * if we are out of lines
      */
-    virtual char *readLine() {
-        bool skip_line = _read_size == 0 && _file_start != 0;
-
-        while (true) {
-            // If we need more data from the file, read it
-            if (_pos >= _buf_length) {
-                // If the file is over, we're done
-                if (_read_size >= _file_end - _file_start || feof(_file) || ferror(_file)) {
-                    char *line = _get_current_line();
-                    // If a -len was provided that is less than the file size, skip the last line
-                    if (_file_end != _file_size) {
-                        if (line != nullptr) {
-                            delete[] line;
-                        }
-                        return nullptr;
-                    }
-                    return line;
-                }
-
-                // Read up to sizeof buf data from the file
-                size_t to_read = sizeof(_buf) / sizeof(char);
-                // If we're up to the requested end position, only read as much as necessary
-                if (_file_start + to_read > _file_end) {
-                    to_read -= (_file_start + to_read) - _file_end;
-                }
-                _buf_length = fread(_buf, sizeof(char), to_read, _file);
-                _read_size += _buf_length;
-
-                // Start processing at the beginning of the buffer
-                _pos = 0;
-                if (_buf_length == 0) {
-                    // If fread returned zero, go back to the start of the loop to check for
-                    // feof/ferror and otherwise try reading again
-                    continue;
-                }
-            }
-
-            // Search for the next newline in the current buffer, and return the completed line
-            // if we find one
-            size_t start = _pos;
-            for (size_t i = start; i < _buf_length; i++) {
-                char c = _buf[i];
-                if (c == '\n') {
-                    _append_current_line(_buf, start, i);
-                    _pos = i + 1;
-
-                    // If we started after 0, skip the first line we read as it may be partial
-                    if (skip_line) {
-                        skip_line = false;
-                        delete[] _get_current_line();
-                        start = i + 1;
-                        continue;
-                    }
-
-                    return _get_current_line();
-                }
+    virtual const char *readLine(size_t &len) {
+        if (_pos >= _file_end) {
+            return nullptr;
+        }
+        const char *line = _data + _pos;
+        const char *newline = (const char *) memchr(line, '\n', _file_end - _pos);
+        if (newline == nullptr) {
+            // If an end was provided that is less than the file size, skip the last line
+            _pos = _file_end;
+            if (_file_end != _file_size && !_aligned) {
+                return nullptr;
             }
-            // If no newline found, loop around and read more file data
-            _append_current_line(_buf, start, _buf_length);
-            _pos = _buf_length;
+            len = _file_end - (line - _data);
+            return line;
         }
+        len = newline - line;
+        _pos = newline - _data + 1;
+        return line;
     }
 
     /**
@@ -302,15 +211,12 @@ public:
      * again.
      */
     virtual void reset() {
-        if (_current_line != nullptr) {
-            delete[] _current_line;
+        _pos = _file_start;
+        // If we started after 0, skip the first line as it may be partial
+        if (_file_start != 0 && !_aligned) {
+            const char *newline = (const char *) memchr(_data + _pos, '\n', _file_end - _pos);
+            _pos = newline == nullptr ? _file_end : newline - _data + 1;
         }
-        _current_line = nullptr;
-        _current_line_size = 0;
-        fseek(_file, _file_start, SEEK_SET);
-        _pos = 0;
-        _buf_length = 0;
-        _read_size = 0;
     }
 };
 
@@ -359,15 +265,18 @@ public:
 
     /**
      * Creates a new SorParser with the given parameters.
-     * @param file The file to read from.
+     * @param data The bytes of the file, e.g. a MappedFile. Must outlive the parser
      * @param file_start the starting index (of bytes in the file)
      * @param file_end The ending index
-     * @param file_size The total size of the file (as obtained by e.g. ftell)
+     * @param file_size The total size of the file
+     * @param aligned Whether file_start and file_end are line starts (or the file bounds)
      */
-    SorParser(FILE *file, size_t file_start, size_t file_end, size_t file_size) : Object() {
-        _reader = new LineReader(file, file_start, file_end, file_size);
+    SorParser(const char *data, size_t file_start, size_t file_end, size_t file_size,
+              bool aligned = false) : Object() {
+        _reader = new LineReader(data, file_start, file_end, file_size, aligned);
         _typeGuesses = nullptr;
         _num_columns = 0;
+        parsed_df = nullptr;
     }
 
     /**
@@ -402,9 +311,8 @@ public:
             case 'S': {
                 slice.trim(STRING_QUOTE);
                 assert(slice.getLength() <= MAX_STRING);
-                char *toCString = slice.toCString();
-                dynamic_cast<StringColumn *>(column1)->push_back(new String(toCString));
-                delete toCString;
+                StringColumn *strings = dynamic_cast<StringColumn *>(column1);
+                strings->push_back(slice.getChars(), slice.getLength());
                 break;
             }
             case 'I':
@@ -443,9 +351,8 @@ public:
             case 'S': {
                 slice.trim(STRING_QUOTE);
                 assert(slice.getLength() <= MAX_STRING);
-                char *toCString = slice.toCString();
-                dynamic_cast<StringColumn *>(column1)->push_back(new String(toCString));
-                delete toCString;
+                StringColumn *strings = dynamic_cast<StringColumn *>(column1);
+                strings->push_back(slice.getChars(), slice.getLength());
                 break;
             }
             case 'I':
@@ -517,22 +424,21 @@ public:
 
     /**
      * Finds and iterates over the deliminated fields in the given line string according to the
-     * given parsing mode.
+     * given parsing mode. Only the delimiters of the line are visited, see forEachDelim().
      * @param line The line to scan/parse
+     * @param len The length of the line
      * @param mode The mode to use
-     * @param columns The data representation to update
      */
-    virtual size_t _scanLine(const char *line, ParserMode mode) {
+    virtual size_t _scanLine(const char *line, size_t len, ParserMode mode) {
         size_t num_fields = 0;
         size_t this_field_start = 0;
         bool in_field = false;
         bool in_string = false;
 
-        // Iterate over the line, create slices for each detected field, and call either
-        // _guessFieldType for ParserMode::DETECT_SCHEMA or _appendField for ParserMode::PARSE_FILE
+        // Create slices for each detected field, and call either _guessFieldType for
+        // ParserMode::DETECT_SCHEMA or _appendField for ParserMode::PARSE_FILE
         // for ParserMode::DETECT_NUM_COLUMNS we simply return the number of fields we saw
-        for (size_t i = 0; i < strlen(line); i++) {
-            char c = line[i];
+        forEachDelim(line, len, [&](size_t i, char c) {
             if (!in_field) {
                 if (c == FIELD_BEGIN) {
                     in_field = true;
@@ -552,7 +458,7 @@ public:
                     num_fields++;
                 }
             }
-        }
+        });
 
         return num_fields;
     }
@@ -561,42 +467,13 @@ public:
     * Finds and iterates over the deliminated fields in the given line string according to the
     * given parsing mode.
     * @param line The line to scan/parse
+    * @param len The length of the line
     * @param mode The mode to use
     * @param columns The data representation to update
     */
-    virtual size_t _scanLine(const char *line, ParserMode mode, Provider::ColumnSet *columns) {
-        size_t num_fields = 0;
-        size_t this_field_start = 0;
-        bool in_field = false;
-        bool in_string = false;
-
-        // Iterate over the line, create slices for each detected field, and call either
-        // _guessFieldType for ParserMode::DETECT_SCHEMA or _appendField for ParserMode::PARSE_FILE
-        // for ParserMode::DETECT_NUM_COLUMNS we simply return the number of fields we saw
-        for (size_t i = 0; i < strlen(line); i++) {
-            char c = line[i];
-            if (!in_field) {
-                if (c == FIELD_BEGIN) {
-                    in_field = true;
-                    this_field_start = i;
-                }
-            } else {
-                if (c == STRING_QUOTE) {
-                    // Allow > inside quoted strings
-                    in_string = !in_string;
-                } else if (c == FIELD_END && !in_string) {
-                    if (mode == ParserMode::DETECT_SCHEMA) {
-                        _guessFieldType(StrSlice(line, this_field_start + 1, i), num_fields);
-                    } else if (mode == ParserMode::PARSE_FILE) {
-                        _appendField(StrSlice(line, this_field_start + 1, i), num_fields);
-                    }
-                    in_field = false;
-                    num_fields++;
-                }
-            }
-        }
-
-        return num_fields;
+    virtual size_t _scanLine(const char *line, size_t len, ParserMode mode,
+                             Provider::ColumnSet *columns) {
+        return _scanLine(line, len, mode);
     }
 
     /**
@@ -608,15 +485,16 @@ public:
         // Detect the row with the most fields in the first 500 lines
         size_t max_columns = 0;
         for (size_t i = 0; i < GUESS_SCHEMA_LINES; i++) {
-            char *next_line = _reader->readLine();
+            size_t len;
+            const char *next_line = _reader->readLine(len);
             if (next_line == nullptr) {
                 break;
             }
-            size_t num_columns = _scanLine(next_line, ParserMode::DETECT_NUM_COLUMNS, nullptr);
+            size_t num_columns =
+                    _scanLine(next_line, len, ParserMode::DETECT_NUM_COLUMNS, nullptr);
             if (num_columns > max_columns) {
                 max_columns = num_columns;
             }
-            delete[] next_line;
         }
         assert(max_columns != 0);
 
@@ -629,16 +507,17 @@ public:
         }
 
         for (size_t i = 0; i < GUESS_SCHEMA_LINES; i++) {
-            char *next_line = _reader->readLine();
+            size_t len;
+            const char *next_line = _reader->readLine(len);
             if (next_line == nullptr) {
                 break;
             }
-            _scanLine(next_line, ParserMode::DETECT_SCHEMA, nullptr);
-            delete[] next_line;
+            _scanLine(next_line, len, ParserMode::DETECT_SCHEMA, nullptr);
         }
 
         ////////////////////////////////////////////
-        /**    DataFrame only created once schema has been guessed. This method must be called before parsing     */
+        /** DataFrame only created once schema has been guessed. This method must be called
+         *  before parsing */
         char *convertedSchema = new char[_num_columns + 1];
         for (size_t j = 0; j < _num_columns; j++) {
             convertedSchema[j] = getCharFromProvColType(_typeGuesses[j]);
@@ -651,6 +530,20 @@ public:
         ////////////////////////////////////////////
     }
 
+    /**
+     * Uses the schema guessed by another parser instead of guessing one, so that parsers of
+     * different parts of a file produce the same columns. Replaces guessSchema().
+     */
+    virtual void useSchema(SorParser &other) {
+        assert(_typeGuesses == nullptr && other._typeGuesses != nullptr);
+        _num_columns = other._num_columns;
+        _typeGuesses = new Provider::ColumnType[_num_columns];
+        for (size_t i = 0; i < _num_columns; i++) {
+            _typeGuesses[i] = other._typeGuesses[i];
+        }
+        this->parsed_df = new DataFrame(*other.parsed_df->schema);
+    }
+
     char getCharFromProvColType(Provider::ColumnType prov_typ) {
         switch (prov_typ) {
             case Provider::ColumnType::STRING:
@@ -679,10 +572,11 @@ public:
 
         _reader->reset();
 
-        char *line;
+        const char *line;
+        size_t len;
         size_t lines_read = 0;
         while (true) {
-            line = _reader->readLine();
+            line = _reader->readLine(len);
             lines_read++;
             // solely to show progress of reading file
             if (lines_read > 9900000 && lines_read % 10000000 == 0) {
@@ -694,12 +588,11 @@ public:
             }
 
             // scan fields scans row by row and fills in the blanks with "append missings"
-            size_t scanned_fields = _scanLine(line, ParserMode::PARSE_FILE);
+            size_t scanned_fields = _scanLine(line, len, ParserMode::PARSE_FILE);
             for (size_t i = scanned_fields; i < _num_columns; i++) {
                 this->parsed_df->columns[i]->appendMissing();
                 this->parsed_df->columns[i]->appendMissing();
             }
-            delete[] line;
         }
     }
 
@@ -711,3 +604,67 @@ public:
         return parsed_df;
     }
 };
+
+/** Files smaller than this many bytes per thread are parsed with fewer threads. */
+static const size_t PARSE_MIN_BYTES = 1024 * 1024;
+
+/**
+ * Parses the bytes [begin, end) of a mapped sor file, which are cut at line starts, with up to
+ * threads threads. The schema is guessed from the start of the file, so that every part of a
+ * file gets the same columns. The range is cut again into one range per thread by
+ * MappedFile::ranges(), each one parsed by its own SorParser straight from the mapping, and
+ * their columns are concatenated in file order. Each thread gets at least min_bytes of the file.
+ */
+static DataFrame *parseSorRange(MappedFile &file, size_t begin, size_t end, size_t threads,
+                                size_t min_bytes = PARSE_MIN_BYTES) {
+    const char *data = file.data();
+    size_t size = file.size();
+
+    vector<size_t> starts = file.ranges(begin, end, threads, min_bytes);
+    size_t ranges = starts.size() - 1;
+
+    SorParser *guesser = new SorParser(data, 0, size, size);
+    guesser->guessSchema();
+    if (ranges == 0) { // nothing to parse
+        DataFrame *df = guesser->parsed_df;
+        delete guesser;
+        return df;
+    }
+
+    vector<SorParser *> parsers(ranges);
+    vector<std::thread> pool;
+    for (size_t i = 0; i < ranges; i++) {
+        parsers[i] = new SorParser(data, starts[i], starts[i + 1], size, true);
+        parsers[i]->useSchema(*guesser);
+        pool.push_back(std::thread([&parsers, i] { parsers[i]->parseFile(); }));
+    }
+    for (size_t i = 0; i < ranges; i++) pool[i].join();
+
+    DataFrame *df = parsers[0]->getParsedDataFrame();
+    for (size_t i = 1; i < ranges; i++) {
+        df->append_chunk(parsers[i]->getParsedDataFrame());
+    }
+    for (size_t i = 0; i < ranges; i++) {
+        parsers[i]->parsed_df = nullptr;
+        delete parsers[i];
+    }
+    delete guesser->parsed_df;
+    delete guesser;
+    return df;
+}
+
+/** Parses the sor file at path with up to threads threads, see parseSorRange(). */
+static DataFrame *parseSorFile(const char *path, size_t threads,
+                               size_t min_bytes = PARSE_MIN_BYTES) {
+    MappedFile file(path);
+    return parseSorRange(file, 0, file.size(), threads, min_bytes);
+}
+
+/** Parses part i of n parts of the sor file at path, see MappedFile::part(). Only the pages of
+ *  that part (and the first lines, to guess the schema) are read. */
+static DataFrame *parseSorPart(const char *path, size_t i, size_t n, size_t threads) {
+    MappedFile file(path);
+    size_t start, end;
+    file.part(i, n, start, end);
+    return parseSorRange(file, start, end, threads);
+}
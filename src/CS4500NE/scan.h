@@ -0,0 +1,177 @@
+// Lang::CwC
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+/**
+ * Finds the sor delimiters ('<', '>' and '"') of a line a block at a time. A block of
+ * SCAN_BLOCK bytes is turned into a bitmask with bit k set when byte k is a delimiter, and the
+ * parser then only visits the set bits. The mask is computed with AVX2 or SSE2 when the CPU has
+ * them, chosen once at startup, and byte by byte otherwise.
+ */
+
+/** Bytes of a block, one bit each in a mask. */
+static const size_t SCAN_BLOCK = 32;
+
+/** Mask of the delimiters in the first len bytes of p, len <= SCAN_BLOCK. */
+static uint32_t delimMaskScalar(const char *p, size_t len) {
+    uint32_t mask = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = p[i];
+        if (c == '<' || c == '>' || c == '"') mask |= (uint32_t) 1 << i;
+    }
+    return mask;
+}
+
+#ifdef SCAN_X86
+/** Mask of the delimiters in the SCAN_BLOCK bytes at p, with SSE2 */
+static uint32_t delimMaskSSE2(const char *p) {
+    __m128i lt = _mm_set1_epi8('<'), gt = _mm_set1_epi8('>'), qt = _mm_set1_epi8('"');
+    __m128i a = _mm_loadu_si128((const __m128i *) p);
+    __m128i b = _mm_loadu_si128((const __m128i *) (p + 16));
+    __m128i da = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(a, lt), _mm_cmpeq_epi8(a, gt)),
+                              _mm_cmpeq_epi8(a, qt));
+    __m128i db = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(b, lt), _mm_cmpeq_epi8(b, gt)),
+                              _mm_cmpeq_epi8(b, qt));
+    return (uint32_t) _mm_movemask_epi8(da) | ((uint32_t) _mm_movemask_epi8(db) << 16);
+}
+
+/** Mask of the delimiters in the SCAN_BLOCK bytes at p, with AVX2 */
+__attribute__((target("avx2")))
+static uint32_t delimMaskAVX2(const char *p) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) p);
+    __m256i d = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('<')),
+                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('>'))),
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+    return (uint32_t) _mm256_movemask_epi8(d);
+}
+#endif
+
+/** Mask of the delimiters in the SCAN_BLOCK bytes at p, without SIMD */
+static uint32_t delimMaskBlockScalar(const char *p) {
+    return delimMaskScalar(p, SCAN_BLOCK);
+}
+
+typedef uint32_t (*DelimMaskFn)(const char *);
+
+/** Returns the best implementation of a full block mask for this CPU */
+static DelimMaskFn pickDelimMask() {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return delimMaskAVX2;
+    if (__builtin_cpu_supports("sse2")) return delimMaskSSE2;
+#endif
+    return delimMaskBlockScalar;
+}
+
+/** The full block mask used by the parser */
+static const DelimMaskFn delimMaskBlock = pickDelimMask();
+
+/**
+ * Calls f(pos, c) for every delimiter c of the len bytes at line, in order. Only whole blocks
+ * are loaded with SIMD, the tail is scanned byte by byte so nothing past len is read.
+ */
+template<class F>
+static void forEachDelim(const char *line, size_t len, F f) {
+    for (size_t base = 0; base < len; base += SCAN_BLOCK) {
+        uint32_t mask = len - base >= SCAN_BLOCK ? delimMaskBlock(line + base)
+                                                 : delimMaskScalar(line + base, len - base);
+        while (mask != 0) {
+            size_t pos = base + __builtin_ctz(mask);
+            mask &= mask - 1;
+            f(pos, line[pos]);
+        }
+    }
+}
+
+/**
+ * Character classes of the words of a text file, a block at a time: for each byte of a block,
+ * one bit in the alnum mask when it is a letter or digit, one in the space mask when it is
+ * whitespace, as isalnum() and isspace() in the C locale. Bytes above 127 are in neither.
+ */
+struct ClassMasks {
+    uint32_t alnum;
+    uint32_t space;
+};
+
+/** Classes of the first len bytes of p, len <= SCAN_BLOCK; the other bits are clear. */
+static ClassMasks classMaskScalar(const char *p, size_t len) {
+    ClassMasks m = {0, 0};
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = p[i];
+        unsigned char l = c | 0x20;
+        if ((c >= '0' && c <= '9') || (l >= 'a' && l <= 'z')) m.alnum |= (uint32_t) 1 << i;
+        if (c == ' ' || (c >= '\t' && c <= '\r')) m.space |= (uint32_t) 1 << i;
+    }
+    return m;
+}
+
+#ifdef SCAN_X86
+/** Classes of 16 bytes, with SSE2. The comparisons are signed, bytes above 127 are negative
+ *  and so below every range. */
+static void classMask16(__m128i v, uint32_t &alnum, uint32_t &space) {
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    __m128i l = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(l, _mm_set1_epi8('a' - 1)),
+                                   _mm_cmplt_epi8(l, _mm_set1_epi8('z' + 1)));
+    __m128i ctrl = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('\t' - 1)),
+                                 _mm_cmplt_epi8(v, _mm_set1_epi8('\r' + 1)));
+    __m128i sp = _mm_or_si128(ctrl, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+    alnum = (uint32_t) _mm_movemask_epi8(_mm_or_si128(digit, letter));
+    space = (uint32_t) _mm_movemask_epi8(sp);
+}
+
+/** Classes of the SCAN_BLOCK bytes at p, with SSE2 */
+static ClassMasks classMaskSSE2(const char *p) {
+    uint32_t a0, s0, a1, s1;
+    classMask16(_mm_loadu_si128((const __m128i *) p), a0, s0);
+    classMask16(_mm_loadu_si128((const __m128i *) (p + 16)), a1, s1);
+    ClassMasks m = {a0 | (a1 << 16), s0 | (s1 << 16)};
+    return m;
+}
+
+/** Classes of the SCAN_BLOCK bytes at p, with AVX2 */
+__attribute__((target("avx2")))
+static ClassMasks classMaskAVX2(const char *p) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) p);
+    __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+    __m256i l = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    __m256i letter = _mm256_and_si256(_mm256_cmpgt_epi8(l, _mm256_set1_epi8('a' - 1)),
+                                      _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), l));
+    __m256i ctrl = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('\t' - 1)),
+                                    _mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), v));
+    __m256i sp = _mm256_or_si256(ctrl, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+    ClassMasks m = {(uint32_t) _mm256_movemask_epi8(_mm256_or_si256(digit, letter)),
+                    (uint32_t) _mm256_movemask_epi8(sp)};
+    return m;
+}
+#endif
+
+/** Classes of the SCAN_BLOCK bytes at p, without SIMD */
+static ClassMasks classMaskBlockScalar(const char *p) {
+    return classMaskScalar(p, SCAN_BLOCK);
+}
+
+typedef ClassMasks (*ClassMaskFn)(const char *);
+
+/** Returns the best implementation of a full block of classes for this CPU */
+static ClassMaskFn pickClassMask() {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return classMaskAVX2;
+    if (__builtin_cpu_supports("sse2")) return classMaskSSE2;
+#endif
+    return classMaskBlockScalar;
+}
+
+/** The full block of classes used by the word reader */
+static const ClassMaskFn classMaskBlock = pickClassMask();
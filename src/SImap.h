@@ -12,154 +12,157 @@
 #include "object.h"
 #include "array.h"
 #include "wrappers/string.h"
-
-class Num : public Object {
-public:
-    size_t v = 0;
-
-    Num() {}
-
-    Num(size_t v) : v(v) {}
-};
-
-/**  Item_ are entries in a Map, they are not exposed, are immutable, own
- *   they key, but the value is external.  author: jv */
-class Items_ {
+#include "column/arena.h"
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+/** Slots of a new SIMap, a power of two. */
+static const size_t SIMAP_FIRST = 16;
+/** Entry of a free slot of an SIMap, or of a missing key. */
+static const size_t SIMAP_EMPTY = SIZE_MAX;
+
+/**
+ * A map from strings to counts, for counting words. Entries are stored
+ * flat, in the order they were added: the characters of the keys in an
+ * arena, their hashes and counts in arrays indexed by entry number. An open
+ * addressing table with linear probing indexes the entries; each slot
+ * keeps the hash of its key inline, so that most mismatches are rejected
+ * without touching the key. The table doubles when it is half full, entry
+ * numbers never change. Counting a word is a single probe, and only a new
+ * word allocates, in the arena.
+ */
+class SIMap : public Object {
 public:
-    Array keys_;
-    Array vals_;
-
-    Items_() : keys_(8), vals_(8) {}
-
-    Items_(Object *k, Object *v) : keys_(8), vals_(8) {
-        keys_.push_back(k);
-        vals_.push_back(v);
+    /** A slot of the table: the hash of a key and its entry */
+    struct Slot {
+        size_t hash;
+        size_t entry;  // SIMAP_EMPTY for a free slot
+    };
+
+    StrArena arena_;             // owned; chars of the keys
+    vector<const char *> keys_;  // chars of each entry, in arena_
+    vector<size_t> hashes_;      // hash of each entry, as String::hash()
+    vector<size_t> counts_;      // count of each entry
+    vector<Slot> slots_;         // open addressing table of entries
+
+    SIMap() {
+        Slot empty = {0, SIMAP_EMPTY};
+        slots_.assign(SIMAP_FIRST, empty);
     }
 
-    ~Items_() {
-
-    }
-
-    /** Returns true if this Items_ contains the given Object **/
-    bool contains_(Object &k) {
-        for (int i = 0; i < keys_.size(); i++)
-            if (k.equals(keys_.get_(i)))
-                return true;
-        return false;
+    /** Returns the number of keys */
+    size_t size() {
+        return keys_.size();
     }
 
-    /** Returns the val associated with the given Object **/
-    Object *get_(Object &k) {
-        for (int i = 0; i < keys_.size(); i++)
-            if (k.equals(keys_.get_(i)))
-                return vals_.get_(i);
-        return nullptr;
+    /** Spreads a String hash over the bits used to index the table */
+    static size_t mix_(size_t hash) {
+        uint64_t h = hash * 0x9E3779B97F4A7C15ULL;
+        return (size_t) (h ^ (h >> 32));
     }
 
-    /** Sets the given key to the given object **/
-    size_t set_(Object &k, Object *v) {
-        for (int i = 0; i < keys_.size(); i++)
-            if (k.equals(keys_.get_(i))) {
-                vals_.put(i, v);
-                return 0;
+    /** Returns the slot of the len chars with the given hash, or of the
+     *  free slot where they would be added */
+    size_t probe_(const char *chars, size_t len, size_t hash) {
+        size_t mask = slots_.size() - 1;
+        size_t i = mix_(hash) & mask;
+        while (slots_[i].entry != SIMAP_EMPTY) {
+            Slot &s = slots_[i];
+            if (s.hash == hash && StrArena::length(keys_[s.entry]) == len &&
+                memcmp(keys_[s.entry], chars, len) == 0) {
+                return i;
             }
-        // The keys are owned, but the key is received as a reference, i.e. not owned so we must make a copy of it.
-        keys_.push_back(k.clone());
-        vals_.push_back(v);
-        return 1;
+            i = (i + 1) & mask;
+        }
+        return i;
     }
 
-    /** Removes the given Object from this Items_ **/
-    size_t erase_(Object &k) {
-        for (int i = 0; i < keys_.size(); i++)
-            if (k.equals(keys_.get_(i))) {
-                keys_.erase_(i);
-                vals_.erase_(i);
-                return 1;
-            }
-        return 0;
+    /** Returns the entry of the len chars with the given hash, adding it
+     *  with a count of 0 if it is missing */
+    size_t upsert(const char *chars, size_t len, size_t hash) {
+        size_t i = probe_(chars, len, hash);
+        if (slots_[i].entry != SIMAP_EMPTY) return slots_[i].entry;
+        size_t e = keys_.size();
+        keys_.push_back(arena_.add(chars, len));
+        hashes_.push_back(hash);
+        counts_.push_back(0);
+        slots_[i].hash = hash;
+        slots_[i].entry = e;
+        if (keys_.size() * 2 > slots_.size()) grow_();
+        return e;
     }
-};
-
-/** A generic map class from Object to Object. Subclasses are responsibly of
- * making the types more specific.  author: jv */
-class Map : public Object {
-public:
-    size_t capacity_;
-    // TODO this was not size of the map, but number of occupied item positions in the top level
-    size_t size_ = 0;
-    Items_ *items_;  // owned
 
-    Map() : Map(10) {}
-
-    Map(size_t cap) {
-        capacity_ = cap;
-        items_ = new Items_[capacity_];
+    /** Adds by to the count of the len chars with the given hash */
+    void increment(const char *chars, size_t len, size_t hash, size_t by = 1) {
+        counts_[upsert(chars, len, hash)] += by;
     }
 
-    ~Map() {
-        delete[] items_;
+    /** Returns the entry of the len chars with the given hash, SIMAP_EMPTY if
+     *  they are not in the map */
+    size_t find(const char *chars, size_t len, size_t hash) {
+        return slots_[probe_(chars, len, hash)].entry;
     }
 
-    /** True if the key is in the map. */
-    bool contains(Object &key) { return items_[off_(key)].contains_(key); }
-
-    /** Return the number of elements in the map. */
-    size_t size() {
-        return size_;
+    /** Returns the count of the key, 0 if it is not in the map */
+    size_t get(String &key) {
+        size_t e = find(key.c_str(), key.size(), key.hash());
+        return e == SIMAP_EMPTY ? 0 : counts_[e];
     }
 
-    /** Returns the offset of the given Object **/
-    size_t off_(Object &k) { return k.hash() % capacity_; }
+    /** Returns which of n partitions the key with the given hash belongs
+     *  to; the same on every node. Taken from other bits than the slot of
+     *  the key, so the keys of one partition still spread over the table. */
+    static size_t bucket(size_t hash, size_t n) {
+        uint64_t h = hash * 0xC2B2AE3D27D4EB4FULL;
+        return (size_t) (h >> 32) % n;
+    }
 
-    /** Get the value.  nullptr is allowed as a value.  */
-    Object *get_(Object &key) { return items_[off_(key)].get_(key); }
+    /** Sets parts to n lists, list k holding the entries of partition k,
+     *  in one pass over the map */
+    void partition(size_t n, vector<vector<size_t>> &parts) {
+        parts.assign(n, vector<size_t>());
+        for (size_t e = 0; e < size(); e++) {
+            parts[bucket(hashes_[e], n)].push_back(e);
+        }
+    }
 
-    /** Add item->val_ at item->key_ either by updating an existing Item_ or
-     * creating a new one if not found.  */
-    void set(Object &k, Object *v) {
-        if (size_ >= capacity_)
-            grow();
-        size_ += items_[off_(k)].set_(k, v);
+    /** Returns the zero terminated chars of the key of entry e; owned by
+     *  the map */
+    const char *key(size_t e) {
+        return keys_[e];
     }
 
-    /** Removes element with given key from the map.  Does nothing if the
-        key is not present.  */
-    void erase(Object &k) {
-        size_ -= items_[off_(k)].erase_(k);
+    size_t key_len(size_t e) {
+        return StrArena::length(keys_[e]);
     }
 
-    /** Resize the map, keeping all Item_s. */
-    void grow() {
-        Map newm(capacity_ * 2);
-        for (size_t i = 0; i < capacity_; i++) {
-            size_t sz = items_[i].keys_.size();
-            for (size_t j = 0; j < sz; j++) {
-                Object *k = items_[i].keys_.get_(j);
-                Object *v = items_[i].vals_.get_(j);
-                newm.set(*k, v);
-                // otherwise the values would get deleted (if the array's destructor was doing its job I found later:)
-                items_[i].vals_.put(j, nullptr);
-            }
+    /** Adds the counts of from to those of this map */
+    void merge(SIMap &from) {
+        for (size_t e = 0; e < from.size(); e++) {
+            increment(from.keys_[e], from.key_len(e), from.hashes_[e], from.counts_[e]);
         }
-        items_ = newm.items_;
-        capacity_ = newm.capacity_;
-        assert(size_ == newm.size_);
-        newm.items_ = nullptr;
     }
 
-}; // Map
-
-class SIMap : public Map {
-public:
-    SIMap() : Map() {}
-
-    Num *get(String &key) { return dynamic_cast<Num *>(get_(key)); }
-
-    /** Adds the String Num pair to this SIMap **/
-    void set(String &k, Num *v) {
-        assert(v);
-        Map::set(k, v);
+    /** Adds the counts of the given entries of from */
+    void merge_entries(SIMap &from, vector<size_t> &entries) {
+        for (size_t j = 0; j < entries.size(); j++) {
+            size_t e = entries[j];
+            increment(from.keys_[e], from.key_len(e), from.hashes_[e], from.counts_[e]);
+        }
     }
 
-}; // KVMap
\ No newline at end of file
+    /** Doubles the table, the entries stay where they are */
+    void grow_() {
+        Slot empty = {0, SIMAP_EMPTY};
+        slots_.assign(slots_.size() * 2, empty);
+        size_t mask = slots_.size() - 1;
+        for (size_t e = 0; e < keys_.size(); e++) {
+            size_t i = mix_(hashes_[e]) & mask;
+            while (slots_[i].entry != SIMAP_EMPTY) i = (i + 1) & mask;
+            slots_[i].hash = hashes_[e];
+            slots_[i].entry = e;
+        }
+    }
+}; // SIMap
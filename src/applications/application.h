@@ -5,6 +5,7 @@
 
 #include "../key/kvstore.h"
 #include "../network/network.h"
+#include "../network/thread.h"
 
 /**
  * The start of our Application class which will be started on each node of the system
@@ -13,28 +14,36 @@ class Application {
 public:
     KVStore *kv;
     size_t idx_;
-    NetworkIP net;
+    NetworkIP &net;  // external
 
-    Application(size_t idx, NetworkIP net) {
+    /** The store of the application is the part homed on this node of the
+     *  distributed store of all the nodes. */
+    Application(size_t idx, NetworkIP &net) : net(net) {
         kv = new KVStore();
         idx_ = idx;
-        this->net = net;
+        kv->connect(&net);
     }
 
-    ~Application() {
+    virtual ~Application() {
+        net.stop(); // the store serves the other nodes until then
         delete kv;
     }
 
-    Application(size_t idx) {
-        kv = new KVStore();
-        this->idx_ = idx;
-    }
-
     /** Returns the index of this node **/
     size_t this_node() {
         return idx_;
     }
 
+    /**
+     * Contructs a DataFrame from the size_t and associates the given Key with the DataFrame in the given KVStore
+     */
+    static void fromScalarInt(Key *key, KVStore *kv, size_t scalar) {
+        Schema s("I");
+        DataFrame *df = new DataFrame(s);
+        df->columns[0]->push_back((int) scalar);
+        kv->put(key, df);
+    }
+
     /** Executes the Application **/
     virtual void run_() {}
 };
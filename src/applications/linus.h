@@ -11,6 +11,7 @@
 #include "../network/network.h"
 #include <iostream>
 #include "../CS4500NE/parser.h"
+#include "../dataframe/snapshot.h"
 
 using namespace std;
 
@@ -29,9 +30,11 @@ public:
     const char *USER = (subset ? "datasets/users_subset.ltgt" : "datasets/users.ltgt");
     const char *COMM = (subset ? "datasets/commits_subset.ltgt" : "datasets/commits.ltgt");
 
-    DataFrame *projects; //  pid x project name
-    DataFrame *users;  // uid x user name
-    DataFrame *commits;  // pid x uid x uid
+    DataFrame *projects; //  pid x project name, this node's part
+    DataFrame *users;  // uid x user name, this node's part
+    DataFrame *commits;  // pid x uid x uid, this node's part
+    size_t nprojects; // rows of all the parts of projects
+    size_t nusers; // rows of all the parts of users
     Set *uSet; // Linus' collaborators
     Set *pSet; // projects of collaborators
 
@@ -52,68 +55,65 @@ public:
         for (size_t i = 0; i < DEGREES; i++) step(i);
     }
 
-    size_t get_file_size(FILE *p_file) // path to file
-    {
-        fseek(p_file, 0, SEEK_END);
-        size_t size = ftell(p_file);
-        return size;
-    }
-
+    /** Loads this node's part of the given sor file from its snapshot, or
+     *  parses it in parallel on arg.threads threads */
     DataFrame *readDataFrameFromFile(const char *filep) {
-
-        FILE *file = fopen(filep, "rb");
-        FILE *file_dup = fopen(filep, "rb");
-        size_t file_size = get_file_size(file_dup);
-
-        SorParser *parser = new SorParser(file, (size_t) 0, (size_t) file_size, (size_t) file_size);
-        parser->guessSchema();
-
         cout << "reading" << endl;
-
-        try {
-            parser->parseFile();
-        } catch (const std::exception &e) {
-            cout << "PARSE FILE: " << e.what() << endl;
-        }
-
-        fclose(file);
-        fclose(file_dup);
-
-        DataFrame *d = parser->parsed_df;
+        DataFrame *d = loadSorFile(filep, arg.threads, arg.snapshot, this_node(), arg.num_nodes);
         cout << "data frame created of SIZE " << d->get_num_rows() << endl;
-        delete parser;
-
         return d;
     }
 
-    /** Node 0 reads three files, cointainng projects, users and commits, and
-     *  creates thre dataframes. All other nodes wait and load the three
-     *  dataframes. Once we know the size of users and projects, we create
-     *  sets of each (uSet and pSet). We also output a data frame with a the
-     *  'tagged' users. At this point the dataframe consists of only
-     *  Linus. **/
+    /** Every node reads its part of the three files, containing projects,
+     *  users and commits, cut at line starts. The nodes then agree on the
+     *  total number of users and projects, the size of the sets of each
+     *  (uSet and pSet). Node 0 gives every node the first 'tagged' users,
+     *  a dataframe consisting of only Linus. **/
     void readInput() {
+        commits = readDataFrameFromFile(COMM);
+        cout << "    " << commits->get_num_rows() << " commits" << endl;
+        projects = readDataFrameFromFile(PROJ);
+        cout << "    " << projects->get_num_rows() << " projects" << endl;
+        users = readDataFrameFromFile(USER);
+        cout << "    " << users->get_num_rows() << " users" << endl;
+        nprojects = total_rows(projects, "projects");
+        nusers = total_rows(users, "users");
         if (this_node() == 0) {
-            commits = readDataFrameFromFile(COMM);
-            cout << "    " << commits->get_num_rows() << " commits" << endl;
-            projects = readDataFrameFromFile(PROJ);
-            cout << "    " << projects->get_num_rows() << " projects" << endl;
-            users = readDataFrameFromFile(USER);
-            cout << "    " << users->get_num_rows() << " users" << endl;
             // This dataframe contains the id of Linus.
-            Key *key = new Key("users-0-0");
-            fromScalarInt(key, kv, LINUS);
-        } else {
-            cout << "Reading..." << endl;
-            commits = readDataFrameFromFile(COMM);
-            cout << "    " << commits->get_num_rows() << " commits" << endl;
-            projects = readDataFrameFromFile(PROJ);
-            cout << "    " << projects->get_num_rows() << " projects" << endl;
-            users = readDataFrameFromFile(USER);
-            cout << "    " << users->get_num_rows() << " users" << endl;
+            Set linus(nusers);
+            linus.set(LINUS);
+            for (size_t k = 0; k < arg.num_nodes; k++) {
+                Key key(StrBuff("users-0-0").get(), k);
+                kv->put(&key, SetCodec::encode(linus));
+            }
         }
-        uSet = new Set(users);
-        pSet = new Set(projects);
+        uSet = new Set(nusers);
+        pSet = new Set(nprojects);
+    }
+
+    /** Returns the rows of all the parts of a file, of which this node holds
+     *  part: every node tells node 0 its count, node 0 tells every node the
+     *  total. */
+    size_t total_rows(DataFrame *part, const char *name) {
+        Key total_key(StrBuff("rows-").c(name).get());
+        if (this_node() != 0) {
+            Key mine(StrBuff("rows-").c(name).c("-").c(idx_).get(), 0);
+            fromScalarInt(&mine, kv, part->get_num_rows());
+            size_t total = kv->waitAndGet(total_key)->get_int(0, 0);
+            kv->erase(total_key);
+            return total;
+        }
+        size_t total = part->get_num_rows();
+        for (size_t k = 1; k < arg.num_nodes; k++) {
+            Key theirs(StrBuff("rows-").c(name).c("-").c(k).get());
+            total += kv->waitAndGet(theirs)->get_int(0, 0);
+            kv->erase(theirs);
+        }
+        for (size_t k = 1; k < arg.num_nodes; k++) {
+            Key to(StrBuff("rows-").c(name).get(), k);
+            fromScalarInt(&to, kv, total);
+        }
+        return total;
     }
 
     /**
@@ -136,153 +136,45 @@ public:
     static DataFrame *fromVisitor(Key *key, KVStore *kv, char *schema, Writer *w) {
         Schema *s = new Schema(schema);
         DataFrame *df = new DataFrame(*s);
+        Row r(s);
         while (!w->done()) {
-            Row *r = new Row(s);
-            w->visit(*r);
-            df->add_row(*r);
-            delete r;
+            w->visit(r);
+            df->add_row(r);
         }
         delete s;
         kv->put(key, df);
         return df;
     }
 
-    /**
-     * Contructs a DataFrame from the size_t and associates the given Key with the DataFrame in the given KVStore
-     */
-    static void *fromScalarInt(Key *key, KVStore *kv, size_t scalar) {
-        Schema *s = new Schema("I");
-        DataFrame *df = new DataFrame(*s);
-        delete s;
-        df->columns[0]->push_back((int) scalar);
-        if (df->get_num_rows() < df->columns[0]->size()) {
-            df->schema->nrow = df->columns[0]->size();
-        }
-        kv->put(key, df);
-    }
-
-    /** Performs a step of the linus calculation. It operates over the three
-     *  datafrrames (projects, users, commits), the sets of tagged users and
-     *  projects, and the users added in the previous round. */
+    /** Performs a step of the linus calculation. It operates over this
+     *  node's part of commits, the sets of tagged users and projects, and the
+     *  users added in the previous round, which every node is given whole.
+     *  The projects each node tags are merged and given back to every node
+     *  before the users are tagged, then the same is done with the users. */
     void step(int stage) {
         cout << "\n\n\nStage " << stage << endl;
-        Schema* chunk_schema = new Schema("I");
-        DataFrame *chunkSoFar = new DataFrame(*chunk_schema);
-        delete chunk_schema;
-
-        /** in this section we chunk up newusers and send them to the nodes **/
-        if (idx_ == 0) {
-            StrBuff *s = new StrBuff();
-            s->c("users-");
-            s->c(stage);
-            s->c("-0");
-            String *t = s->get();
-            Key *uK = new Key(t); // TODO Delete?
-            delete s;
-            DataFrame *newUsers = kv->get(*uK);
-
-            cout << "newusers size: " << newUsers->get_num_rows() << endl;
-
-            //number of chunks
-            int num_chunks = 1 + ((newUsers->get_num_rows() - 1) / arg.rows_per_chunk);
-            if (num_chunks < 0) {
-                num_chunks = 1;
-            }
-
-            cout << "sending num chunks" << endl;
-            //sending out the number of chunks each will receive
-            for (size_t k = 1; k < arg.num_nodes; k++) {
-                int num_received = 0;
-                int selectedNode = 0;
-                for (size_t w = 0; w < num_chunks; w++) {
-                    if (selectedNode == k) {
-                        num_received++;
-                    }
-                    selectedNode++;
-                    if (selectedNode > arg.num_nodes - 1) {
-                        selectedNode = 0;
-                    }
-                }
-                Schema* node_calc_schema = new Schema("I");
-                DataFrame *node_calc = new DataFrame(*node_calc_schema);
-                delete node_calc_schema;
-                node_calc->columns[0]->push_back(num_received);
-                Status *chunkMsg = new Status(0, k, node_calc);
-                this->net.send_m(chunkMsg);
-                delete chunkMsg;
-            }
-
-            cout << "sent num chunks" << endl;
-
-            /** node 0 send out newUsers to nodes in chunks **/
-            // Split into chunks and send iteratively to nodes
-            int round2 = 0;
-
-            for (size_t j = 0; j < num_chunks; j++) {
-                DataFrame *cur_chunk = newUsers->chunk(j);
-                // if server's turn, keep chunks of DataFrame.
-                if (round2 == 0) {
-                    // append chunks as received
-                    chunkSoFar->append_chunk(cur_chunk);
-                    round2++;
-                    if (round2 == arg.num_nodes) {
-                        round2 = 0;
-                    }
-                } else {
-                    // Sending to Clients
-                    Status *chunkMsg = new Status(0, round2, cur_chunk);
-                    this->net.send_m(chunkMsg);
-                    delete chunkMsg;
-                    round2++;
-                    if (round2 == arg.num_nodes) {
-                        round2 = 0;
-                    }
-                }
-            }
-
-            delete newUsers;
-            cout << "sent chunks" << endl;
-        } else {
-            //Calculating the number of chunks and figuring out how many go to this node
-            //recieve a status
-            cout << "client waiting to recieve num chunks" << endl;
-            Status *ipd = dynamic_cast<Status *>(this->net.recv_m());
-            cout << "client recieved num chunks expected" << endl;
-            int num_received = *ipd->msg_->columns[0]->as_int()->get(0);
+        Key uK(StrBuff("users-").c(stage).c("-0").get());
+        Set delta(nusers);
+        SetCodec::decode_into(kv->waitAndGet(uK), delta);
+        kv->erase(uK);
+        cout << "newusers size: " << delta.num_true() << endl;
 
-            //recieving how many chunks theyre getting
-            for (size_t i = 0; i < num_received; i++) {
-                cout << "client waiting to receive chunk" << endl;
-                Status *ipd = dynamic_cast<Status *>(this->net.recv_m());
-                cout << "client received" << endl;
-
-                chunkSoFar->append_chunk(ipd->msg_);
-                cout << "done appending" << endl;
-            }
-        }
+        ProjectsTagger *ptagger = new ProjectsTagger(delta, *pSet, nprojects);
+        commits->pmap(*ptagger); // marking the projects of this node's commits touched by delta
 
-        /** all nodes  **/
-        Set delta(users);
-        SetUpdater *upd = new SetUpdater(delta);
-        chunkSoFar->map(upd); // all of the new users are copied to delta.
-        delete upd;
-        delete chunkSoFar;
-        ProjectsTagger *ptagger = new ProjectsTagger(delta, *pSet, projects);
-        commits->map(ptagger); // marking all projects touched by delta
-
-        /** nodes send back commits, server merges projects **/
+        /** nodes send back projects, server merges them and sends them to all **/
         merge(ptagger->newProjects, "projects-", stage);
+        Key pK(StrBuff("projects-").c(stage).c("-0").get());
+        kv->erase(pK);
 
         cout << "first merge done" << endl;
         pSet->union_(ptagger->newProjects);
 
-        /** server **/
-        UsersTagger *utagger = new UsersTagger(ptagger->newProjects, *uSet, users);
-        delete ptagger;
-
-        commits->map(utagger);
+        UsersTagger *utagger = new UsersTagger(ptagger->newProjects, *uSet, nusers);
+        commits->pmap(*utagger);
+        delete ptagger; // utagger reads its newProjects
         cout << "second merge" << endl;
-        /** nodes send users and server merges **/
+        /** nodes send users, server merges them and sends them to all **/
         merge(utagger->newUsers, "users-", stage + 1);
         uSet->union_(utagger->newUsers);
         delete utagger;
@@ -293,47 +185,41 @@ public:
     }
 
     /** Gather updates to the given set from all the nodes in the systems.
-     * The union of those updates is then published as dataframe.  The key
-     * used for the otuput is of the form "name-stage-0" where name is either
-     * 'users' or 'projects', stage is the degree of separation being
-     * computed.
+     * The union of those updates is then published as dataframe on every
+     * node, and every node's set becomes that union. The key used for the
+     * output is of the form "name-stage-0" where name is either 'users' or
+     * 'projects', stage is the degree of separation being computed. Sets
+     * travel encoded by SetCodec, and are merged a word at a time.
      */
     void merge(Set &set, char const *name, int stage) {
         if (this_node() == 0) {
             cout << "in merge server" << endl;
+            // deltas are put here as name-stage-<node> and merged as they arrive
+            vector<Key *> pending;
             for (size_t i = 1; i < arg.num_nodes; ++i) {
-                cout << "recieving..." << endl;
-                Status *msg = dynamic_cast<Status *>(this->net.recv_m());
-                cout << "recieved." << endl;
-                DataFrame *delta = msg->msg_;
-
+                pending.push_back(new Key(StrBuff(name).c(stage).c("-").c(i).get()));
+            }
+            while (!pending.empty()) {
+                size_t which;
+                DataFrame *delta = kv->waitAndGetAny(pending, which);
                 cout << "    received delta of " << delta->get_num_rows() << endl;
-                cout << " elements from node " << i << endl;
-                SetUpdater *upd = new SetUpdater(set);
-                delta->map(upd);
-                delete msg;
-                delete delta;
+                cout << " ints from " << pending[which]->c_str() << endl;
+                SetCodec::decode_into(delta, set);
+                kv->erase(*pending[which]); // deletes delta
+                delete pending[which];
+                pending.erase(pending.begin() + which);
+            }
+            cout << "    storing " << set.num_true() << " merged elements" << endl;
+            for (size_t k = 0; k < arg.num_nodes; k++) {
+                Key out(StrBuff(name).c(stage).c("-0").get(), k);
+                kv->put(&out, SetCodec::encode(set));
             }
-            cout << "    storing " << set.size() << " merged elements" << endl;
-            SetWriter *writer = new SetWriter(set);
-            StrBuff *h = new StrBuff();
-            h->c(name);
-            h->c(stage);
-            h->c("-0");
-            String *str = h->get();
-            Key *k = new Key(str);
-            delete h;
-            fromVisitor(k, kv, "I", writer);
-            delete writer;
         } else {
-            cout << "    sending " << set.size() << " elements to master node" << endl;
-            SetWriter *writer = new SetWriter(set);
-            Key *k = new Key(StrBuff(name).c(stage).c("-").c(idx_).get());
-            DataFrame *toSend = fromVisitor(k, kv, "I", writer);
-            delete writer;
-            Status *nodeToServer = new Status(idx_, 0, toSend);
-            this->net.send_m(nodeToServer);
-            delete nodeToServer;
+            cout << "    sending " << set.num_true() << " elements to master node" << endl;
+            Key k(StrBuff(name).c(stage).c("-").c(idx_).get(), 0);
+            kv->put(&k, SetCodec::encode(set));
+            Key out(StrBuff(name).c(stage).c("-0").get());
+            SetCodec::decode_into(kv->waitAndGet(out), set);
         }
     }
 }; // Linus
@@ -14,171 +14,98 @@
 #include "../args.h"
 #include "../writer.h"
 #include "../SImap.h"
+#include "../mapped.h"
 #include <iostream>
+#include <thread>
 
 using namespace std;
 
-/***************************************************************************/
-
-class MutableString : public String {
-public:
-    MutableString() : String("", 0) {}
-
-    void become(const char *v) {
-        size_ = strlen(v);
-        cstr_ = (char *) v;
-        hash_ = hash_me();
-    }
-};
-
-class KeyBuff : public Object {
-public:
-    Key *orig_; // external
-    StrBuff buf_;
-
-    KeyBuff(Key *orig) {
-        orig_ = new Key(orig);
-        buf_ = *new StrBuff(orig->c_str());
-    }
-
-    ~KeyBuff() {
-        //delete orig_;
-    }
-
-    KeyBuff &c(String &s) {
-        buf_.c(s);
-        return *this;
-    }
-
-    KeyBuff &c(size_t v) {
-        buf_.c(v);
-        return *this;
-    }
-
-    KeyBuff &c(const char *v) {
-        buf_.c(v);
-        return *this;
-    }
-
-    Key *get() {
-        //buf_.c(orig_->c_str());
-        String *s = buf_.get();
-        Key *k = new Key(s->steal(), orig_->home);
-        buf_ = *new StrBuff("wc-map-");
-        //delete s;
-        return k;
-    }
-
-}; // KeyBuff
+/** Bytes of the file below which a node counts its words on one thread. */
+static const size_t WC_MIN_BYTES = 1024 * 1024;
 
 /****************************************************************************
  * Calculate a word count for given file:
- *   1) read the data (single node)
- *   2) produce word counts per homed chunks, in parallel
+ *   1) every node reads its own part of the file, cut at line starts
+ *   2) produce word counts per node, in parallel
  *   3) combine the results
+ * The file is never read whole by one node: each node counts the words of
+ * about 1/N of it, straight from the file buffer into a map, so a node
+ * holds its distinct words and never a row per word. With -shuffle true
+ * (the default) the counts are then partitioned by the hash of their word,
+ * node k reducing partition k of every node's counts, and node 0 only adds
+ * up the number of distinct words of each partition. Otherwise the counts
+ * stream back to node 0, which merges them all as they arrive.
  **********************************************************author: pmaj ****/
 class WordCount : public Application {
 public:
     static const size_t BUFSIZE = 1024;
-    Key in; // mapped to words local count needed for (a subset of words_all).
-    KeyBuff kbuf;
     SIMap all;
-    Key words_all; // used by server to separate word chunks.
 
     WordCount(size_t idx, NetworkIP &net) :
-            Application(idx, net), in("data"), kbuf(new Key("wc-map-", 0)), words_all("words-all") {
-        kv->put(&in, new DataFrame(*new Schema("S")));
-    }
+            Application(idx, net) {}
 
-    /** The master nodes reads the input, then all of the nodes count. */
+    /** Every node counts the words of its part of the file, then the counts
+     *  are reduced by partition or on node 0. */
     void run_() override {
-
-        if (idx_ == 0) {
-            // Reads in File to Dataframe
-            FileReader *fr = new FileReader();
-            DataFrame *df = fromVisitor(&words_all, kv, "S", fr);
-
-            // Split into chunks and send iteratively to nodes
-            int num_chunks = 1 + ((df->get_num_rows() - 1) / arg.rows_per_chunk);
-            int selectedNode = 0;
-
-            for (size_t j = 0; j < num_chunks; j++) {
-                DataFrame *cur_chunk = df->chunk(j);
-
-                // if server's turn, keep chunks of DataFrame.
-                if (selectedNode == 0) {
-                    // put chunks into local kv store as received
-                    DataFrame *chunkSoFar = kv->get(*new Key("data"));
-                    chunkSoFar->append_chunk(cur_chunk);
-                    kv->put(new Key("data"), chunkSoFar);
-                } else {
-                    // Sending to Clients
-                    Status *chunkMsg = new Status(0, selectedNode, cur_chunk);
-                    cout << "Server sending chunk" << endl;
-                    this->net.send_m(chunkMsg);
-                }
-                // increment selected node circularly between nodes
-                selectedNode = ++selectedNode == arg.num_nodes ? selectedNode = 0 : selectedNode++;
-            }
-
-            local_count();
-
-
-            //HERE IS WHERE WE RECEIVE EVERYONE AND ADD THEIR DFs to the KV
-            for (size_t i = 1; i < arg.num_nodes; i++) {
-                Status *msg = dynamic_cast<Status *>(this->net.recv_m());
-                StrBuff *s = new StrBuff();
-                s->c("wc-map-");
-                s->c(msg->sender_);
-                this->kv->put(new Key(s->get()), msg->msg_);
-            }
-
-            //Theoretically everyone should now be in the store to reduce
-            reduce();
-
+        SIMap map;
+        count_part(map);
+        if (arg.shuffle) {
+            shuffle(map);
+        } else if (idx_ == 0) {
+            reduce(map);
         } else {
-
-            //Finding out size of file
-            FileReader *fr = new FileReader();
-            DataFrame *df = fromVisitor(&words_all, kv, "S", fr);
-
-            //Calculating the number of chunks and figuring out how many go to this node
-            int num_chunks = 1 + ((df->get_num_rows() - 1) / arg.rows_per_chunk);
-            int num_received = 0;
-            int selectedNode = 0;
-            for (int i = 0; i < num_chunks; i++) {
-                if (selectedNode == idx_) {
-                    num_received++;
-                }
-                selectedNode++;
-                if (selectedNode > arg.num_nodes - 1) {
-                    selectedNode = 0;
-                }
-            }
-
-            for (size_t i = 0; i < num_received; i++) {
-                cout << "client waiting to receive chunk" << endl;
-                Status *ipd = dynamic_cast<Status *>(this->net.recv_m());
-                cout << "client received" << endl;
-
-                DataFrame *chunkSoFar = kv->get(*new Key("data"));
-                chunkSoFar->append_chunk(ipd->msg_);
-                kv->put(new Key("data"), chunkSoFar);
-            }
-
-            local_count();
-            StrBuff *s = new StrBuff();
-            s->c("wc-map-");
-            s->c(this->idx_);
-            Key *key_counts2 = new Key(s->get());
-            DataFrame *storeDF = kv->get(key_counts2);
-            Status msg(this->idx_, 0, storeDF);
-            this->net.send_m(&msg);
-            cout << "sending chunk back" << endl;
+            Summer cnt(map);
+            Key k(StrBuff("wc-part-").c(idx_).get(), 0);
+            fromVisitor(&k, kv, "SI", &cnt);
             cout << "DONE" << endl;
         }
     }
 
+    /** Counts the words of this node's part of the file into map. The part
+     *  is cut again into a range per thread by MappedFile::ranges(), up to
+     *  arg.threads of at least WC_MIN_BYTES each. Every thread counts its
+     *  range with an Adder of its own, as DataFrame::pmap does, and the
+     *  Adders are joined by joinTree(), merging their maps in parallel. */
+    void count_part(SIMap &map) {
+        vector<size_t> starts;
+        {
+            MappedFile file(arg.file); // only the pages around the cuts are read
+            size_t start, end;
+            file.part(idx_, arg.num_nodes, start, end);
+            starts = file.ranges(start, end, arg.threads, WC_MIN_BYTES);
+        }
+        size_t ranges = starts.size() - 1;
+        if (ranges == 0) return; // an empty part
+        Adder add(map);
+        vector<Rower *> adders(1, &add);
+        for (size_t i = 1; i < ranges; i++) adders.push_back(add.clone());
+        vector<size_t> words(ranges);
+        vector<std::thread> pool;
+        for (size_t i = 1; i < ranges; i++) {
+            pool.push_back(std::thread(&WordCount::count_range_,
+                                       &dynamic_cast<Adder *>(adders[i])->map_,
+                                       starts[i], starts[i + 1], &words[i]));
+        }
+        count_range_(&map, starts[0], starts[1], &words[0]);
+        for (size_t i = 0; i < pool.size(); i++) {
+            pool[i].join();
+            words[0] += words[i + 1];
+        }
+        joinTree(adders);
+        cout << "read " << words[0] << " words" << endl;
+    }
+
+    /** Counts the words of the bytes [start, end) of the file into map and
+     *  sets words to how many there were */
+    static void count_range_(SIMap *map, size_t start, size_t end, size_t *words) {
+        FileReader fr(arg.file, start, end, arg.lowercase);
+        *words = 0;
+        fr.forEachWord([map, words](const char *chars, size_t len) {
+            map->increment(chars, len, String::hash_chars(chars, len));
+            (*words)++;
+        });
+    }
+
     /**
      * Contructs a DataFrame of the given schema from the given FileReader and puts it in the KVStore at the given Key
      */
@@ -186,11 +113,10 @@ public:
         cout << "in fromVisitor" << endl;
         Schema *s = new Schema(schema);
         DataFrame *df = new DataFrame(*s);
+        Row r(s);
         while (!w->done()) {
-            Row *r = new Row(s);
-            w->visit(*r);
-            df->add_row(*r);
-            //delete r;
+            w->visit(r);
+            df->add_row(r);
         }
         //delete s;
         cout << "done visiting" << endl;
@@ -198,60 +124,77 @@ public:
         return df;
     }
 
-    /** Returns a key for given node.  These keys are homed on master node
-     *  which then joins them one by one. */
-    Key *mk_key(size_t idx) {
-        kbuf = *new KeyBuff(new Key("wc-map-"));
-        Key *k = kbuf.c(idx).get();
-        return k;
-    }
-
-    /** Compute word counts on the local node and build a data frame. */
-    void local_count() {
-        DataFrame *words = kv->get(new Key("data"));
-        SIMap map;
-        Adder *add = new Adder(map);
-        words->map(add);
-        Summer *cnt = new Summer(map);
-
-        StrBuff *s = new StrBuff();
-        s->c("wc-map-");
-        s->c(this->idx_);
-        Key *key_counts = new Key(s->get());
-
-        fromVisitor(key_counts, kv, "SI", cnt);
-    }
-
-    /** Merge the data frames of all nodes */
-    void reduce() {
-        if (this_node() != 0) return;
+    /** Merges into map the counts of the other nodes, in the order they
+     *  arrive */
+    void reduce(SIMap &map) {
         cout << "Node 0: reducing counts..." << endl;
-        SIMap map;
+        vector<Key *> pending;
+        for (size_t i = 1; i < arg.num_nodes; i++) {
+            pending.push_back(new Key(StrBuff("wc-part-").c(i).get()));
+        }
+        gather_(pending, map);
 
-        StrBuff *s = new StrBuff();
-        s->c("wc-map-");
-        s->c(this->idx_);
-        Key *own = new Key(s->get());
-        DataFrame *df = kv->get(*own);
-        merge(df, map);
+        cout << "Different words: " << map.size() << endl;
 
-        for (size_t i = 1; i < arg.num_nodes; ++i) { // merge other nodes
-            StrBuff *s = new StrBuff();
-            s->c("wc-map-");
-            s->c(i);
+    }
 
-            Key *ok = new Key(s->get());
-            merge(kv->get(*ok), map);
+    /**
+     * Sends partition k of the counts in map to node k, for every other node
+     * k, and reduces partition idx_ of the counts of all the nodes. Each
+     * node then tells node 0 how many distinct words its partition has;
+     * since a word belongs to a single partition node 0 only adds them up.
+     */
+    void shuffle(SIMap &map) {
+        size_t n = arg.num_nodes;
+        vector<vector<size_t>> parts;
+        map.partition(n, parts);
+        for (size_t k = 0; k < n; k++) {
+            if (k == idx_) continue;
+            Summer part(map, parts[k]);
+            Key to(StrBuff("wc-shuffle-").c(k).c("-").c(idx_).get(), k);
+            fromVisitor(&to, kv, "SI", &part);
         }
+        SIMap mine;
+        mine.merge_entries(map, parts[idx_]);
+        vector<Key *> pending;
+        for (size_t j = 0; j < n; j++) {
+            if (j == idx_) continue;
+            pending.push_back(new Key(StrBuff("wc-shuffle-").c(idx_).c("-").c(j).get()));
+        }
+        gather_(pending, mine);
+        cout << "Node " << idx_ << ": " << mine.size() << " words in its partition" << endl;
 
-        cout << "Different words: " << map.size() << endl;
+        if (idx_ != 0) {
+            Key to(StrBuff("wc-distinct-").c(idx_).get(), 0);
+            fromScalarInt(&to, kv, mine.size());
+            cout << "DONE" << endl;
+            return;
+        }
+        size_t distinct = mine.size();
+        for (size_t k = 1; k < n; k++) {
+            Key theirs(StrBuff("wc-distinct-").c(k).get());
+            distinct += kv->waitAndGet(theirs)->get_int(0, 0);
+            kv->erase(theirs);
+        }
+        cout << "Different words: " << distinct << endl;
+    }
 
+    /** Merges into map the counts stored under the pending keys, which are
+     *  homed here, in the order they arrive; the keys are deleted. */
+    void gather_(vector<Key *> &pending, SIMap &map) {
+        while (!pending.empty()) {
+            size_t which;
+            merge(kv->waitAndGetAny(pending, which), map);
+            kv->erase(*pending[which]);
+            delete pending[which];
+            pending.erase(pending.begin() + which);
+        }
     }
 
     /** Adds map values into dataframe */
     void merge(DataFrame *df, SIMap &m) {
-        Adder *add = new Adder(m);
-        df->map(add);
+        Adder add(m);
+        df->pmap(add);
     }
 
 }; // WordcountDemo
\ No newline at end of file
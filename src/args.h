@@ -1,8 +1,10 @@
 #pragma once
 
 #include "object.h"
+#include "column/segments.h"
 #include <string>
 #include <iostream>
+#include <thread>
 #include <assert.h>
 
 using namespace std;
@@ -13,14 +15,21 @@ public:
     bool pseudo = false;
     size_t num_nodes = 0;
     size_t subset = 0;
-    size_t rows_per_chunk = 10 * 1000; // how many rows per chunk
+    size_t rows_per_chunk = SEGMENT_SIZE; // how many rows per chunk, one column segment
     size_t index = 0; //which node is this
     size_t port = 0; // client port
     char *master_ip; // server ip
     size_t master_port; // server port
     char *app; // which application to run
+    size_t threads; // worker threads of DataFrame::pmap
+    bool snapshot = false; // keep binary snapshots of the parsed sor files, next to them
+    bool shuffle = true; // reduce word counts by hash partition, not all on node 0
+    bool lowercase = false; // count words regardless of case
 
-    Args() {}
+    Args() {
+        threads = thread::hardware_concurrency();
+        if (threads == 0) threads = 1;
+    }
 
     ~Args() {
 //        delete[] file;
@@ -54,6 +63,14 @@ public:
                 master_port = atol(n);
             } else if (strcmp(a, "-rowsperchunk") == 0) {
                 rows_per_chunk = atol(n);
+            } else if (strcmp(a, "-snapshot") == 0) {
+                snapshot = (strcmp(n, "true") == 0);
+            } else if (strcmp(a, "-lowercase") == 0) {
+                lowercase = (strcmp(n, "true") == 0);
+            } else if (strcmp(a, "-shuffle") == 0) {
+                shuffle = (strcmp(n, "true") == 0);
+            } else if (strcmp(a, "-threads") == 0) {
+                threads = atol(n) > 0 ? atol(n) : 1;
             } else {
                 cout << "Unknown command line: " << a << " " << n << endl;
             }
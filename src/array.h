@@ -29,7 +29,7 @@ public:
     }
 
     ~Array() {
-        for (int i = 0; i < capacity_; i++) {
+        for (size_t i = 0; i < size_; i++) {
             delete arr_[i];
         }
         delete[] arr_;
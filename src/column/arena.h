@@ -0,0 +1,74 @@
+/**************************************************************************
+ * StrArena ::
+ * Append-only storage for the characters of many strings. Strings are
+ * copied into large blocks, each one laid out as a 4 byte length, the
+ * characters and a terminating zero, so the pointer returned by add() can
+ * be used as a C string and is stable for the lifetime of the arena.
+ * Blocks start small and double up to ARENA_BLOCK bytes; a string longer
+ * than that gets a block of its own.
+ */
+#pragma once
+
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+/** Bytes per full arena block. */
+static const size_t ARENA_BLOCK = 64 * 1024;
+/** Bytes of the first block of an arena. */
+static const size_t ARENA_FIRST = 256;
+
+class StrArena {
+public:
+    vector<char *> blocks_;  // owned
+    size_t used_;            // bytes used in the last block
+    size_t capacity_;        // bytes of the last block
+
+    StrArena() {
+        used_ = 0;
+        capacity_ = 0;
+    }
+
+    ~StrArena() {
+        clear();
+    }
+
+    /** Frees all the strings of this arena */
+    void clear() {
+        for (size_t i = 0; i < blocks_.size(); i++) {
+            delete[] blocks_[i];
+        }
+        blocks_.clear();
+        used_ = 0;
+        capacity_ = 0;
+    }
+
+    /** Copies the len chars into the arena, returns the zero terminated copy */
+    const char *add(const char *chars, size_t len) {
+        size_t need = (sizeof(uint32_t) + len + 1 + 3) & ~(size_t) 3;
+        if (used_ + need > capacity_) {
+            size_t cap = capacity_ == 0 ? ARENA_FIRST : capacity_ * 2;
+            if (cap > ARENA_BLOCK) cap = ARENA_BLOCK;
+            if (cap < need) cap = need;
+            blocks_.push_back(new char[cap]);
+            capacity_ = cap;
+            used_ = 0;
+        }
+        char *entry = blocks_.back() + used_;
+        uint32_t l = (uint32_t) len;
+        memcpy(entry, &l, sizeof(uint32_t));
+        memcpy(entry + sizeof(uint32_t), chars, len);
+        entry[sizeof(uint32_t) + len] = 0;
+        used_ += need;
+        return entry + sizeof(uint32_t);
+    }
+
+    /** Returns the length of a string returned by add() */
+    static size_t length(const char *chars) {
+        uint32_t l;
+        memcpy(&l, chars - sizeof(uint32_t), sizeof(uint32_t));
+        return l;
+    }
+};
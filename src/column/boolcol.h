@@ -7,40 +7,37 @@ class FloatColumn;
 #pragma once
 
 #include "column.h"
+#include "segments.h"
 #include "intcol.h"
 #include "floatcol.h"
 #include "stringcol.h"
 #include "../wrappers/string.h"
-#include "../wrappers/bool.h"
 #include <iostream>
-#include <vector>
+#include <stdint.h>
 
 using namespace std;
 
 /**
- * Represent a Column of Bool
+ * Represent a Column of bool. Values are bit-packed, 64 to a word, there is
+ * no per-cell object.
  */
 class BoolColumn : public Column {
 public:
-    vector<Bool*> vals_;
+    SegmentArray<uint64_t> bits_; // bit i of word i / 64 holds value i
+    size_t size_;                 // number of values
 
     BoolColumn() {
+        size_ = 0;
     }
 
     ~BoolColumn() {
-        for (int i = 0; i < vals_.size(); i++) {
-            if (vals_[i] != nullptr) {
-                delete vals_[i];
-            }
-        }
-        //delete[] vals_;
     }
 
     /**
      * Append missing bool is default 0.
      */
     void appendMissing() {
-        vals_.push_back(new Bool(false));
+        push_back(false);
     }
 
     /**
@@ -75,21 +72,23 @@ public:
         return nullptr;
     }
 
-    /** Returns the Bool at idx; undefined on invalid idx.*/
-    bool *get(size_t idx) {
-            return &vals_.at(idx)->val;
+    /** Returns the bool at idx; undefined on invalid idx.*/
+    bool get(size_t idx) {
+        return (bits_.get(idx >> 6) >> (idx & 63)) & 1;
     }
 
     /** Out of bound idx is undefined. */
-    void set(size_t idx, bool *val) {
-            vals_.at(idx) = new Bool(*val);
+    void set(size_t idx, bool val) {
+        uint64_t mask = (uint64_t) 1 << (idx & 63);
+        uint64_t word = bits_.get(idx >> 6);
+        bits_.set(idx >> 6, val ? word | mask : word & ~mask);
     }
 
     /**
      * Returns the size of this BoolColumn
      */
     size_t size() {
-        return vals_.size();
+        return size_;
     }
 
     /**
@@ -103,7 +102,9 @@ public:
      * Adds the given bool to this if it is a BoolColumn
      */
     virtual void push_back(bool val) {
-        vals_.push_back(new Bool(val));
+        if ((size_ & 63) == 0) bits_.push_back(0);
+        size_++;
+        set(size_ - 1, val);
     }
 
     /**
@@ -120,23 +121,41 @@ public:
             exit(1);
     }
 
+    /** Appends len values of the given BoolColumn starting at start. Whole
+     *  words are taken over when both sides are word aligned. */
+    virtual void append(Column *from, size_t start, size_t len) {
+        BoolColumn *other = from->as_bool();
+        if ((start & 63) == 0 && (size_ & 63) == 0) {
+            bits_.append(other->bits_, start >> 6, (len + 63) >> 6);
+            size_ += len;
+            return;
+        }
+        for (size_t i = start; i < start + len; i++) {
+            push_back(other->get(i));
+        }
+    }
+
     /** Return the type of this column as a char: 'S', 'B', 'I' and 'F'. */
     virtual char get_type() {
         return 'B';
     }
 
-    /** Serializes this BoolCol **/
-    virtual String *serialize() {
-        StrBuff *s = new StrBuff();
-        s->c("B}");
+    /** Values are sent bit-packed, as the words they are stored in */
+    virtual void serialize(Gather &g) {
+        bits_.write_to(g);
+    }
 
-        for (int i = 0; i < this->vals_.size(); i++) {
-            char str[256] = ""; /* In fact not necessary as snprintf() adds the 0-terminator. */
-            snprintf(str, sizeof str, "%d}", this->vals_.at(i)->val);
-            s->c(str);
+    virtual void deserialize(Scatter &in, size_t rows) {
+        size_t words = (rows + 63) >> 6;
+        if ((size_ & 63) == 0) {
+            bits_.read_from(in, words);
+            size_ += rows;
+            return;
+        }
+        vector<uint64_t> bits(words);
+        in.read((char *) bits.data(), words * sizeof(uint64_t));
+        for (size_t i = 0; i < rows; i++) {
+            push_back((bool) ((bits[i >> 6] >> (i & 63)) & 1));
         }
-
-        s->c("!");
-        return s->get();
     }
 };
\ No newline at end of file
@@ -17,6 +17,12 @@ class IntColumn;
 
 #include "../object.h"
 #include "../wrappers/string.h"
+#include "../network/gather.h"
+#include <stdint.h>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "the binary encoding of columns is little-endian, values are copied as is"
+#endif
 
 class Column : public Object {
 public:
@@ -47,9 +53,20 @@ public:
     /** Return the type of this column as a char: 'S', 'B', 'I' and 'F'. */
     virtual char get_type() {}
 
-    /** Return the serialization of this Column as a String */
-    virtual String *serialize() {}
+    /** Adds the binary encoding of the values of this Column to g, where
+      * it starts and ends on a BIN_ALIGN boundary. The values may be
+      * referenced rather than copied: the column must not change until g is
+      * sent. */
+    virtual void serialize(Gather &g) {}
+
+    /** Appends rows values decoded from the encoding written by serialize(),
+      * read from in. */
+    virtual void deserialize(Scatter &in, size_t rows) {}
 
     /** Append a missing by pushing back default value for the Column */
     virtual void appendMissing() {}
+
+    /** Appends the len values of from, a column of the same type, starting
+      * at row start. Segments are shared instead of copied when aligned. */
+    virtual void append(Column *from, size_t start, size_t len) {}
 };
\ No newline at end of file
@@ -11,7 +11,7 @@ class FloatColumn;
 #include "stringcol.h"
 #include "../wrappers/string.h"
 #include "column.h"
-#include "../wrappers/float.h"
+#include "segments.h"
 #include <iostream>
 #include <string>
 #include <vector>
@@ -19,29 +19,24 @@ class FloatColumn;
 using namespace std;
 
 /**
- * Represent a Column of Float
+ * Represent a Column of float. Values are stored unboxed in fixed-size
+ * segments, there is no per-cell object.
  */
 class FloatColumn : public Column {
 public:
-    vector<Float*> vals_;
+    SegmentArray<float> vals_;
 
     FloatColumn() {
     }
 
     ~FloatColumn() {
-        for (int i = 0; i < vals_.size(); i++) {
-            if (vals_[i] != nullptr) {
-                delete vals_[i];
-            }
-        }
-//        delete vals_;
     }
 
     /**
-    * Append missing bool is default 0.
+    * Append missing float is default 0.
     */
     void appendMissing() {
-        vals_.push_back(new Float(0));
+        vals_.push_back(0);
     }
 
     /**
@@ -77,13 +72,13 @@ public:
     }
 
     /** Returns the float at idx; undefined on invalid idx.*/
-    float *get(size_t idx) {
-            return &vals_[idx]->val;
+    float get(size_t idx) {
+        return vals_.get(idx);
     }
 
     /** Out of bound idx is undefined. */
-    void set(size_t idx, float *val) {
-            vals_[idx] = new Float(*val);
+    void set(size_t idx, float val) {
+        vals_.set(idx, val);
     }
 
     /**
@@ -112,7 +107,7 @@ public:
      * Adds the given float to this if it is a FloatColumn
      */
     virtual void push_back(float val) {
-        vals_.push_back(new Float(val));
+        vals_.push_back(val);
     }
 
     /**
@@ -122,23 +117,24 @@ public:
             exit(1);
     }
 
+    /** Appends len values of the given FloatColumn starting at start */
+    virtual void append(Column *from, size_t start, size_t len) {
+        vals_.append(from->as_float()->vals_, start, len);
+    }
+
     /** Return the type of this column as a char: 'S', 'B', 'I' and 'F'. */
     virtual char get_type() {
         return 'F';
     }
 
-    /** Serializes this FloatColumn **/
-    virtual String *serialize() {
-        StrBuff *s = new StrBuff();
-        s->c("F}");
-
-        for (int i = 0; i < this->vals_.size(); i++) {
-            char str[256] = ""; /* In fact not necessary as snprintf() adds the 0-terminator. */
-            snprintf(str, sizeof str, "%f}", this->vals_[i]->val);
-            s->c(str);
-        }
+    /** Values are stored as is, 4 bytes little-endian each */
+    virtual void serialize(Gather &g) {
+        vals_.write_to(g);
+        g.pad();
+    }
 
-        s->c("!");
-        return s->get();
+    virtual void deserialize(Scatter &in, size_t rows) {
+        vals_.read_from(in, rows);
+        in.skip_pad();
     }
-};
\ No newline at end of file
+};
@@ -7,12 +7,12 @@ class FloatColumn;
 #pragma once
 
 #include "column.h"
+#include "segments.h"
 #include "boolcol.h"
 #include "floatcol.h"
 #include "stringcol.h"
 #include "../wrappers/string.h"
 #include "iostream"
-#include "../wrappers/integer.h"
 #include <iostream>
 #include <vector>
 
@@ -20,29 +20,24 @@ class FloatColumn;
 using namespace std;
 
 /**
- * Represent a Column of Integer
+ * Represent a Column of int. Values are stored unboxed in fixed-size
+ * segments, there is no per-cell object.
  */
 class IntColumn : public Column {
 public:
-    vector<Integer*> vals_;
+    SegmentArray<int> vals_;
 
     IntColumn() {
     }
 
     ~IntColumn() {
-        for (int i = 0; i < size(); i++) {
-            if (vals_[i] != nullptr) {
-                delete vals_[i];
-            }
-        }
-      //  delete[] vals_;
     }
 
     /**
-    * Append missing bool is default 0.
+    * Append missing int is default 0.
     */
     void appendMissing() {
-        vals_.push_back(new Integer((int)0));
+        vals_.push_back(0);
     }
 
 
@@ -79,13 +74,13 @@ public:
     }
 
     /** Returns the int at idx; undefined on invalid idx.*/
-    int *get(size_t idx) {
-            return &vals_[idx]->val;
+    int get(size_t idx) {
+        return vals_.get(idx);
     }
 
     /** Out of bound idx is undefined. */
-    void set(size_t idx, int *val) {
-            vals_[idx] = new Integer(*val);
+    void set(size_t idx, int val) {
+        vals_.set(idx, val);
     }
 
     /**
@@ -99,7 +94,7 @@ public:
      * Adds the given int to this if it is a IntColumn
      */
     virtual void push_back(int val) {
-        this->vals_.push_back(new Integer(val));
+        this->vals_.push_back(val);
     }
 
     /**
@@ -124,23 +119,24 @@ public:
         exit(1);
     }
 
+    /** Appends len values of the given IntColumn starting at start */
+    virtual void append(Column *from, size_t start, size_t len) {
+        vals_.append(from->as_int()->vals_, start, len);
+    }
+
     /** Return the type of this column as a char: 'S', 'B', 'I' and 'F'. */
     virtual char get_type() {
         return 'I';
     }
 
-    /** Serializes this intcol **/
-    virtual String *serialize() {
-        StrBuff *s = new StrBuff();
-        s->c("I}");
-
-        for (int i = 0; i < this->vals_.size(); i++) {
-            char str[256] = ""; /* In fact not necessary as snprintf() adds the 0-terminator. */
-            snprintf(str, sizeof str, "%d}", this->vals_[i]->val);
-            s->c(str);
-        }
+    /** Values are stored as is, 4 bytes little-endian each */
+    virtual void serialize(Gather &g) {
+        vals_.write_to(g);
+        g.pad();
+    }
 
-        s->c("!");
-        return s->get();
+    virtual void deserialize(Scatter &in, size_t rows) {
+        vals_.read_from(in, rows);
+        in.skip_pad();
     }
-};
\ No newline at end of file
+};
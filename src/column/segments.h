@@ -0,0 +1,196 @@
+/**************************************************************************
+ * SegmentArray ::
+ * Growable array of plain values stored in fixed-size segments reached
+ * through a segment directory. Appending never moves values that are
+ * already stored, only the directory of segment pointers grows. Segments
+ * are reference counted so that a column cut out of another one can share
+ * its segments instead of copying them; a shared segment is copied before
+ * it is written to (copy on write).
+ *
+ * Every segment but the last one is full, so value i lives at offset
+ * i % SEGMENT_SIZE of segment i / SEGMENT_SIZE. Only the first segment
+ * starts small and doubles up to SEGMENT_SIZE, which keeps tiny columns
+ * (scalars, network chunks) tiny.
+ *
+ * T must be copyable with memcpy. Reference counts are not synchronized,
+ * sharing segments across threads must be done before the threads start.
+ */
+#pragma once
+
+#include <cstring>
+#include <cassert>
+#include <vector>
+
+using namespace std;
+
+/** Values per full segment, a power of two. */
+static const size_t SEGMENT_BITS = 16;
+static const size_t SEGMENT_SIZE = (size_t) 1 << SEGMENT_BITS;
+static const size_t SEGMENT_MASK = SEGMENT_SIZE - 1;
+/** Capacity of the first segment of a new array. */
+static const size_t SEGMENT_FIRST = 16;
+
+/** A block of values shared by one or more SegmentArrays. */
+template<class T>
+class Segment {
+public:
+    T *vals_;          // owned
+    size_t capacity_;  // number of values vals_ can hold
+    size_t refs_;      // number of arrays holding this segment
+
+    Segment(size_t capacity) {
+        vals_ = new T[capacity];
+        capacity_ = capacity;
+        refs_ = 1;
+    }
+
+    ~Segment() {
+        delete[] vals_;
+    }
+};
+
+template<class T>
+class SegmentArray {
+public:
+    vector<Segment<T> *> dir_;  // segment directory; segments are shared
+    size_t size_;              // number of values
+
+    SegmentArray() {
+        size_ = 0;
+    }
+
+    ~SegmentArray() {
+        clear();
+    }
+
+    /** Drops all values, releasing the segments. */
+    void clear() {
+        for (size_t i = 0; i < dir_.size(); i++) {
+            release_(dir_[i]);
+        }
+        dir_.clear();
+        size_ = 0;
+    }
+
+    /** Returns the number of values */
+    size_t size() {
+        return size_;
+    }
+
+    /** Returns the value at idx; undefined on invalid idx. */
+    T get(size_t idx) {
+        return dir_[idx >> SEGMENT_BITS]->vals_[idx & SEGMENT_MASK];
+    }
+
+    /** Overwrites the value at idx; undefined on invalid idx. */
+    void set(size_t idx, T val) {
+        size_t seg = idx >> SEGMENT_BITS;
+        own_(seg, dir_[seg]->capacity_);
+        dir_[seg]->vals_[idx & SEGMENT_MASK] = val;
+    }
+
+    /** Appends val. */
+    void push_back(T val) {
+        size_t seg = size_ >> SEGMENT_BITS;
+        size_t off = size_ & SEGMENT_MASK;
+        if (seg == dir_.size()) {
+            dir_.push_back(new Segment<T>(seg == 0 ? SEGMENT_FIRST : SEGMENT_SIZE));
+        } else if (off == dir_[seg]->capacity_ || dir_[seg]->refs_ > 1) {
+            own_(seg, off + 1);
+        }
+        dir_[seg]->vals_[off] = val;
+        size_++;
+    }
+
+    /** Appends n values copied from vals. */
+    void push_back(const T *vals, size_t n) {
+        while (n > 0) {
+            size_t seg = size_ >> SEGMENT_BITS;
+            size_t off = size_ & SEGMENT_MASK;
+            size_t run = SEGMENT_SIZE - off < n ? SEGMENT_SIZE - off : n;
+            if (seg == dir_.size()) {
+                dir_.push_back(new Segment<T>(seg == 0 ? SEGMENT_FIRST : SEGMENT_SIZE));
+            }
+            own_(seg, off + run);
+            memcpy(dir_[seg]->vals_ + off, vals, run * sizeof(T));
+            size_ += run;
+            vals += run;
+            n -= run;
+        }
+    }
+
+    /** Appends the len values of from starting at start. Whole segments of
+     *  from are shared rather than copied whenever both sides are segment
+     *  aligned, which is the case for every segment when start and the
+     *  current size are multiples of SEGMENT_SIZE. */
+    void append(SegmentArray<T> &from, size_t start, size_t len) {
+        assert(start + len <= from.size_);
+        while (len > 0) {
+            size_t seg = start >> SEGMENT_BITS;
+            size_t off = start & SEGMENT_MASK;
+            size_t run = SEGMENT_SIZE - off < len ? SEGMENT_SIZE - off : len;
+            if (off == 0 && (size_ & SEGMENT_MASK) == 0) {
+                Segment<T> *s = from.dir_[seg];
+                s->refs_++;
+                dir_.push_back(s);
+                size_ += run;
+            } else {
+                push_back(from.dir_[seg]->vals_ + off, run);
+            }
+            start += run;
+            len -= run;
+        }
+    }
+
+    /** Appends the bytes of the values to out, one c(bytes, len) call per
+     *  segment. */
+    template<class Out>
+    void write_to(Out &out) {
+        for (size_t seg = 0; seg < dir_.size(); seg++) {
+            size_t run = size_ - (seg << SEGMENT_BITS);
+            if (run > SEGMENT_SIZE) run = SEGMENT_SIZE;
+            out.c((const char *) dir_[seg]->vals_, run * sizeof(T));
+        }
+    }
+
+    /** Appends n values read from in, in.read(bytes, len) copies them
+     *  straight into the segments. */
+    template<class In>
+    void read_from(In &in, size_t n) {
+        while (n > 0) {
+            size_t seg = size_ >> SEGMENT_BITS;
+            size_t off = size_ & SEGMENT_MASK;
+            size_t run = SEGMENT_SIZE - off < n ? SEGMENT_SIZE - off : n;
+            if (seg == dir_.size()) {
+                size_t capacity = seg == 0 ? SEGMENT_FIRST : SEGMENT_SIZE;
+                while (capacity < run) capacity *= 2;
+                dir_.push_back(new Segment<T>(capacity));
+            }
+            own_(seg, off + run);
+            in.read((char *) (dir_[seg]->vals_ + off), run * sizeof(T));
+            size_ += run;
+            n -= run;
+        }
+    }
+
+    /** Makes segment seg private to this array with room for at least need
+     *  values, copying it if it is shared or too small. */
+    void own_(size_t seg, size_t need) {
+        Segment<T> *s = dir_[seg];
+        if (s->refs_ == 1 && s->capacity_ >= need) return;
+        size_t capacity = s->capacity_;
+        while (capacity < need) capacity *= 2;
+        if (capacity > SEGMENT_SIZE) capacity = SEGMENT_SIZE;
+        Segment<T> *copy = new Segment<T>(capacity);
+        size_t used = size_ - (seg << SEGMENT_BITS);
+        if (used > s->capacity_) used = s->capacity_;
+        memcpy(copy->vals_, s->vals_, used * sizeof(T));
+        release_(s);
+        dir_[seg] = copy;
+    }
+
+    /** Drops one reference to s, deleting it with the last one. */
+    static void release_(Segment<T> *s) {
+        if (--s->refs_ == 0) delete s;
+    }
+};
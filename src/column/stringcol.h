@@ -1,7 +1,10 @@
 /*************************************************************************
  * StringColumn::
- * Holds string pointers. The strings are external.  Nullptr is a valid
- * value.
+ * Holds strings. The characters are copied into an append-only arena owned
+ * by the column, cells only refer to them, so get() hands out a view into
+ * the arena and never allocates. A column can be dictionary encoded: each
+ * distinct string is then stored once and cells hold integer codes, which
+ * lets readers compare and hash strings by code.
  */
 
 class IntColumn;
@@ -13,7 +16,10 @@ class FloatColumn;
 #pragma once
 
 #include "column.h"
+#include "segments.h"
+#include "arena.h"
 #include <cstdarg>
+#include <atomic>
 #include "../wrappers/string.h"
 #include "boolcol.h"
 #include "floatcol.h"
@@ -25,29 +31,32 @@ class FloatColumn;
 using namespace std;
 
 /**
- * Represent a Int of Float SoR Type
+ * Represent a Column of String
  */
 class StringColumn : public Column {
 public:
-    vector<String*> vals_;
+    StrArena arena_;                  // owned; characters of the strings
+    SegmentArray<const char *> vals_; // chars of each cell, unused when encoded
+    bool encoded_;                    // is this column dictionary encoded
+    size_t dict_id_;                  // identifies the dictionary, 0 when not encoded
+    SegmentArray<int> codes_;         // code of each cell when encoded
+    vector<const char *> dict_;       // chars of each code
+    vector<size_t> dict_hash_;        // hash of each code
+    vector<int> index_;               // open addressing table of codes, -1 is empty
 
     StringColumn() {
+        encoded_ = false;
+        dict_id_ = 0;
     }
 
     ~StringColumn() {
-        for (int i = 0; i < size(); i++) {
-            if (vals_[i] != nullptr) {
-                delete vals_[i];
-            }
-        }
-       // delete[] vals_;
     }
 
     /**
-    * Append missing bool is default 0.
+    * Append missing string is default "".
     */
     void appendMissing() {
-        vals_.push_back(new String(""));
+        push_back("", 0);
     }
 
     /**
@@ -82,22 +91,49 @@ public:
         return nullptr;
     }
 
-    /** Returns the string at idx; undefined on invalid idx.*/
-    String *get(size_t idx) {
+    /** Returns the zero terminated chars of the string at idx; they are owned
+     *  by the column. Undefined on invalid idx.*/
+    const char *get(size_t idx) {
+        return encoded_ ? dict_[codes_.get(idx)] : vals_.get(idx);
+    }
+
+    /** Returns the length of the string at idx */
+    size_t length(size_t idx) {
+        return StrArena::length(get(idx));
+    }
+
+    /** Returns the dictionary code of the string at idx, -1 if the column is
+     *  not encoded */
+    int code(size_t idx) {
+        return encoded_ ? codes_.get(idx) : -1;
+    }
+
+    /** Returns the hash of the string at idx, same as String::hash() */
+    size_t hash(size_t idx) {
+        if (encoded_) return dict_hash_[codes_.get(idx)];
+        const char *chars = vals_.get(idx);
+        return String::hash_chars(chars, StrArena::length(chars));
+    }
 
-        return vals_[idx];
+    /** Returns the number of distinct strings of an encoded column */
+    size_t dict_size() {
+        return dict_.size();
     }
 
-    /** Out of bound idx is undefined. */
+    /** Out of bound idx is undefined. The string is copied, val is external. */
     void set(size_t idx, String *val) {
-            vals_[idx] = val;
+        if (encoded_) {
+            codes_.set(idx, intern_(val->c_str(), val->size()));
+        } else {
+            vals_.set(idx, arena_.add(val->c_str(), val->size()));
+        }
     }
 
     /**
      * Returns the size of this StringColumn
      */
     size_t size() {
-        return vals_.size();
+        return encoded_ ? codes_.size() : vals_.size();
     }
 
     /**
@@ -122,10 +158,82 @@ public:
     }
 
     /**
-     * Adds the given String to this if it is a StringColumn
+     * Adds a copy of the given String to this; val is external.
      */
     virtual void push_back(String *val) {
-        vals_.push_back(val);
+        push_back(val->c_str(), val->size());
+    }
+
+    /**
+     * Adds a copy of the len given chars to this.
+     */
+    void push_back(const char *chars, size_t len) {
+        if (encoded_) {
+            codes_.push_back(intern_(chars, len));
+        } else {
+            vals_.push_back(arena_.add(chars, len));
+        }
+    }
+
+    /**
+     * Switches this column to dictionary encoding, existing cells included.
+     * Strings pushed afterwards are stored once per distinct value.
+     */
+    void encode() {
+        if (encoded_) return;
+        static std::atomic<size_t> dict_ids(0);
+        dict_id_ = ++dict_ids;
+        encoded_ = true;
+        index_.assign(16, -1);
+        for (size_t i = 0; i < vals_.size(); i++) {
+            const char *chars = vals_.get(i);
+            codes_.push_back(intern_(chars, StrArena::length(chars)));
+        }
+        vals_.clear();
+    }
+
+    /** Returns the code of the given chars, adding them to the dictionary if
+     *  they are new. */
+    int intern_(const char *chars, size_t len) {
+        size_t h = String::hash_chars(chars, len);
+        size_t mask = index_.size() - 1;
+        size_t slot = h & mask;
+        while (index_[slot] != -1) {
+            int c = index_[slot];
+            if (dict_hash_[c] == h && StrArena::length(dict_[c]) == len &&
+                memcmp(dict_[c], chars, len) == 0) {
+                return c;
+            }
+            slot = (slot + 1) & mask;
+        }
+        int c = (int) dict_.size();
+        dict_.push_back(arena_.add(chars, len));
+        dict_hash_.push_back(h);
+        index_[slot] = c;
+        if (dict_.size() * 2 > index_.size()) grow_index_();
+        return c;
+    }
+
+    /** Doubles the dictionary index. */
+    void grow_index_() {
+        index_.assign(index_.size() * 2, -1);
+        size_t mask = index_.size() - 1;
+        for (size_t c = 0; c < dict_.size(); c++) {
+            size_t slot = dict_hash_[c] & mask;
+            while (index_[slot] != -1) slot = (slot + 1) & mask;
+            index_[slot] = (int) c;
+        }
+    }
+
+    /** Appends copies of len strings of the given StringColumn starting at
+     *  start. Strings are owned by their column's arena so they are copied;
+     *  an encoded column interns them. */
+    virtual void append(Column *from, size_t start, size_t len) {
+        StringColumn *other = from->as_string();
+        for (size_t i = start; i < start + len; i++) {
+            const char *chars = other->get(i);
+            push_back(chars, StrArena::length(chars));
+        }
     }
 
     /** Return the type of this column as a char: 'S', 'B', 'I' and 'F'. */
@@ -133,20 +241,32 @@ public:
         return 'S';
     }
 
-    /** Returns the serialization of this StringColumn as a String */
-    virtual String *serialize() {
-        StrBuff *s = new StrBuff();
-        s->c("S}");
-
-        for (int i = 0; i < this->vals_.size(); i++) {
-            char str[256] = ""; /* In fact not necessary as snprintf() adds the 0-terminator. */
-            snprintf(str, sizeof str, "%s}", this->vals_[i]->c_str());
-            s->c(str);
+    /** Strings are sent as size() + 1 offsets, 8 bytes each, into a blob of
+     *  their characters with no terminators. Both are copied, the arena
+     *  interleaves lengths with the characters. */
+    virtual void serialize(Gather &g) {
+        uint64_t off = 0;
+        g.copy((const char *) &off, sizeof(uint64_t));
+        for (size_t i = 0; i < size(); i++) {
+            off += length(i);
+            g.copy((const char *) &off, sizeof(uint64_t));
+        }
+        for (size_t i = 0; i < size(); i++) {
+            g.copy(get(i), length(i));
         }
+        g.pad();
+    }
 
-        s->c("!");
-        String* st = s->get();
-        delete s;
-        return st;
+    virtual void deserialize(Scatter &in, size_t rows) {
+        vector<uint64_t> offs(rows + 1);
+        in.read((char *) offs.data(), offs.size() * sizeof(uint64_t));
+        if (in.failed_) return;
+        vector<char> blob(offs[rows]);
+        in.read(blob.data(), blob.size());
+        if (in.failed_) return;
+        for (size_t i = 0; i < rows; i++) {
+            push_back(blob.data() + offs[i], offs[i + 1] - offs[i]);
+        }
+        in.skip_pad();
     }
-};
\ No newline at end of file
+};
@@ -25,9 +25,14 @@
 #include "../writer.h"
 #include "../reader.h"
 #include "../array.h"
+#include "../args.h"
+#include <vector>
 
 using namespace std;
 
+/** Fewest rows pmap gives to a thread, smaller frames use fewer threads. */
+static const size_t PMAP_MIN_ROWS = 16 * 1024;
+
 /** Represents a set of data */
 class DataFrame : public Object {
 public:
@@ -102,18 +107,19 @@ public:
     /** Return the value at the given column and row. Accessing rows or
      *  columns out of bounds, or request the wrong type is undefined.*/
     int get_int(size_t col, size_t row) {
-        return *columns[col]->as_int()->get(row);
+        return columns[col]->as_int()->get(row);
     }
 
     bool get_bool(size_t col, size_t row) {
-        return *columns[col]->as_bool()->get(row);
+        return columns[col]->as_bool()->get(row);
     }
 
     float get_float(size_t col, size_t row) {
-        return *columns[col]->as_float()->get(row);
+        return columns[col]->as_float()->get(row);
     }
 
-    String *get_string(size_t col, size_t row) {
+    /** The chars are owned by the column */
+    const char *get_string(size_t col, size_t row) {
         return columns[col]->as_string()->get(row);
     }
 
@@ -130,15 +136,15 @@ public:
       * If the column is not  of the right type or the indices are out of
       * bound, the result is undefined. */
     void set(size_t col, size_t row, int val) {
-        columns[col]->as_int()->set(row, &val);
+        columns[col]->as_int()->set(row, val);
     }
 
     void set(size_t col, size_t row, bool val) {
-        columns[col]->as_bool()->set(row, &val);
+        columns[col]->as_bool()->set(row, val);
     }
 
     void set(size_t col, size_t row, float val) {
-        columns[col]->as_float()->set(row, &val);
+        columns[col]->as_float()->set(row, val);
     }
 
     void set(size_t col, size_t row, String *val) {
@@ -156,14 +162,19 @@ public:
                     row.set(i, columns[i]->as_float()->get(idx));
                     break;
                 case 'B':
-                    row.set(i, (bool) *columns[i]->as_bool()->get(idx));
+                    row.set(i, columns[i]->as_bool()->get(idx));
                     break;
                 case 'I':
-                    row.set(i, (int) *columns[i]->as_int()->get(idx));
+                    row.set(i, columns[i]->as_int()->get(idx));
                     break;
-                case 'S':
-                    row.set(i, columns[i]->as_string()->get(idx));
+                case 'S': {
+                    StringColumn *sc = columns[i]->as_string();
+                    const char *chars = sc->get(idx);
+                    int code = sc->code(idx);
+                    row.set_view(i, chars, StrArena::length(chars),
+                                 code < 0 ? 0 : sc->dict_hash_[code], code, sc->dict_id_);
                     break;
+                }
             }
         }
     }
@@ -213,32 +224,67 @@ public:
         return schema->get_num_cols();
     }
 
-    /** Visits the rows in order on THIS node */
+    /** Visits the rows in order on THIS node. A single row is filled in
+     *  turn with every row of the dataframe, so the visitor must not keep
+     *  the row nor its strings past the call to visit. */
     void map(Reader *r) {
-        int completed = 0;
-
-        for (size_t i = 0; i < this->get_num_rows(); i++) {
-            Row *row = new Row(this->schema);
-            this->fill_row(i, *row);
-            completed++;
-            r->visit(*row);
-            delete row;
+        Row row(this->schema);
+        size_t nrows = this->get_num_rows();
+        for (size_t i = 0; i < nrows; i++) {
+            row.set_idx(i);
+            this->fill_row(i, row);
+            r->visit(row);
         }
+    }
 
+    /** Visits the rows [start, end) in order with a row of its own. */
+    void map_range_(Rower *r, size_t start, size_t end) {
+        Row row(this->schema);
+        for (size_t i = start; i < end; i++) {
+            row.set_idx(i);
+            this->fill_row(i, row);
+            r->accept(row);
+        }
     }
 
-    /** Visits the rows in order on THIS node */
-    void map(Writer *r) {
-        int completed = 0;
-
-        for (size_t i = 0; i < this->get_num_rows(); i++) {
-            Row *row = new Row(this->schema);
-            this->fill_row(i, *row);
-            completed++;
-            r->visit(*row);
-            delete row;
+    /** Visits the rows on THIS node with up to arg.threads threads. The rows
+     *  are split in contiguous ranges, the first one is given to r and the
+     *  others to clones of r, each with state of its own (e.g. the word
+     *  counts of an Adder). Once all are done, the rowers are joined into r
+     *  by joinTree(), in parallel and in range order.
+     *  If r cannot be cloned it visits all the rows on this thread. */
+    void pmap(Rower &r) {
+        size_t nrows = this->get_num_rows();
+        size_t nthreads = nrows / PMAP_MIN_ROWS;
+        if (nthreads > arg.threads) nthreads = arg.threads;
+        vector<Rower *> rowers(1, &r);
+        for (size_t i = 1; i < nthreads; i++) {
+            Rower *c = r.clone();
+            if (c == nullptr) break;
+            rowers.push_back(c);
+        }
+        nthreads = rowers.size();
+        vector<thread> workers;
+        for (size_t i = 1; i < nthreads; i++) {
+            workers.push_back(thread(&DataFrame::map_range_, this, rowers[i],
+                                     nrows * i / nthreads, nrows * (i + 1) / nthreads));
+        }
+        map_range_(&r, 0, nrows / nthreads);
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
         }
+        joinTree(rowers);
+    }
 
+    /** Visits the rows in order on THIS node, reusing a single row. */
+    void map(Writer *r) {
+        Row row(this->schema);
+        size_t nrows = this->get_num_rows();
+        for (size_t i = 0; i < nrows; i++) {
+            row.set_idx(i);
+            this->fill_row(i, row);
+            r->visit(row);
+        }
     }
 
     /** Print the dataframe in SoR format to standard output. */
@@ -247,16 +293,16 @@ public:
             for (size_t j = 0; j < get_num_rows(); j++) {
                 switch (columns[i]->get_type()) {
                     case 'F':
-                        cout << "<" << *columns[i]->as_float()->get(j) << ">";
+                        cout << "<" << columns[i]->as_float()->get(j) << ">";
                         break;
                     case 'B':
-                        cout << "<" << *columns[i]->as_bool()->get(j) << ">";
+                        cout << "<" << columns[i]->as_bool()->get(j) << ">";
                         break;
                     case 'I':
-                        cout << "<" << *columns[i]->as_int()->get(j) << ">";
+                        cout << "<" << columns[i]->as_int()->get(j) << ">";
                         break;
                     case 'S':
-                        cout << "<" << columns[i]->as_string()->get(j)->cstr_ << ">";
+                        cout << "<" << columns[i]->as_string()->get(j) << ">";
                         break;
                 }
             }
@@ -264,22 +310,38 @@ public:
         }
     }
 
-    /** Returns a section of this DataFrame as a new DataFrame **/
-    DataFrame *chunk(size_t chunk_select) {
+    /** Dictionary encodes every string column of this DataFrame. */
+    void encode_strings() {
+        for (size_t i = 0; i < get_num_cols(); i++) {
+            if (columns[i]->get_type() == 'S') {
+                columns[i]->as_string()->encode();
+            }
+        }
+    }
 
-        int start_row = chunk_select * arg.rows_per_chunk;
-        DataFrame *df = new DataFrame(*this->schema);
+    /** Returns the number of chunks of arg.rows_per_chunk rows this
+     *  DataFrame splits into **/
+    size_t num_chunks() {
+        return (get_num_rows() + arg.rows_per_chunk - 1) / arg.rows_per_chunk;
+    }
 
-        for (size_t i = start_row; i < start_row + arg.rows_per_chunk; i++) {
-            if (i >= this->get_num_rows()) {
-                return df;
-            } else {
-                Row *r = new Row(this->schema);
-                this->fill_row(i, *r);
-                df->add_row(*r);
-                delete r;
-            }
+    /** Returns a section of this DataFrame as a new DataFrame. When
+     *  arg.rows_per_chunk is a multiple of SEGMENT_SIZE the chunk shares the
+     *  column segments of this DataFrame instead of copying them. **/
+    DataFrame *chunk(size_t chunk_select) {
+        size_t start_row = chunk_select * arg.rows_per_chunk;
+        DataFrame *df = new DataFrame(*this->schema);
+        if (start_row >= this->get_num_rows()) {
+            return df;
+        }
+        size_t len = this->get_num_rows() - start_row;
+        if (len > arg.rows_per_chunk) {
+            len = arg.rows_per_chunk;
         }
+        for (size_t i = 0; i < get_num_cols(); i++) {
+            df->columns[i]->append(this->columns[i], start_row, len);
+        }
+        df->schema->nrow = len;
         return df;
     }
 
@@ -287,23 +349,33 @@ public:
      * Returns the double at the given column and row in this DataFrame
      */
     float get_double(int col, int row) {
-        return *this->columns[col]->as_float()->get(row);
+        return this->columns[col]->as_float()->get(row);
     }
 
     /**
-     * Adds chunk dataframe passed in to this dataframe
+     * Adds chunk dataframe passed in to this dataframe, column by column.
+     * Segments of the chunk are taken over when this DataFrame ends on a
+     * segment boundary.
      */
     DataFrame *append_chunk(DataFrame *df) {
-        for (size_t r = 0; r < df->get_num_rows(); r++) {
-            Row *r2 = df->get_row(r);
-            this->add_row(*r2);
-            delete r2;
-        }
+        append_rows(df);
         delete df;
 
         return this;
     }
 
+    /** Appends the rows of the given DataFrame, which has the same schema
+     *  and stays owned by the caller. **/
+    DataFrame *append_rows(DataFrame *df) {
+        size_t rows = df->get_num_rows();
+        for (size_t i = 0; i < get_num_cols(); i++) {
+            this->columns[i]->append(df->columns[i], 0, rows);
+        }
+        this->schema->nrow += rows;
+
+        return this;
+    }
+
 };
 
 
@@ -311,32 +383,35 @@ public:
  * A bit set contains size() booleans that are initialize to false and can
  * be set to true with the set() method. The test() method returns the
  * value. Does not grow.
+ *
+ * The booleans are packed 64 to a word, bit i % 64 of word i / 64, and the
+ * bits past size() are always 0, so that set operations and counts work a
+ * word at a time.
  ************************************************************************/
 class Set {
 public:
-    bool *vals_;  // owned; data
-    size_t size_; // number of elements
+    uint64_t *words_; // owned; data
+    size_t size_;     // number of elements
+    size_t nwords_;   // number of words
 
     /** Creates a set of the same size as the dataframe. */
-    Set(DataFrame *df) {
-        vals_ = new bool[df->get_num_rows()];
-        size_ = df->get_num_rows();
-        for (size_t i = 0; i < size_; i++) {
-            vals_[i] = false;
-        }
-    }
+    Set(DataFrame *df) : Set(df->get_num_rows()) {}
 
     /** Creates a set of the given size. */
     Set(size_t sz) {
-        vals_ = new bool[sz];
         size_ = sz;
-        for (size_t i = 0; i < size_; i++) {
-            vals_[i] = false;
-        }
+        nwords_ = (sz + 63) / 64;
+        words_ = new uint64_t[nwords_];
+        clear();
     }
 
     ~Set() {
-        delete[] vals_;
+        delete[] words_;
+    }
+
+    /** Removes every element */
+    void clear() {
+        memset(words_, 0, nwords_ * sizeof(uint64_t));
     }
 
     /** Add idx to the set. If idx is out of bound, ignore it.  Out of bound
@@ -345,79 +420,165 @@ public:
      */
     void set(size_t idx) {
         if (idx >= size_) return; // ignoring out of bound writes
-        vals_[idx] = true;
+        words_[idx >> 6] |= (uint64_t) 1 << (idx & 63);
     }
 
     /** Is idx in the set?  See comment for set(). */
     bool test(size_t idx) {
         if (idx >= size_) return true; // ignoring out of bound reads
-        return vals_[idx];
+        return (words_[idx >> 6] >> (idx & 63)) & 1;
     }
 
     size_t size() { return size_; }
 
     size_t num_true() {
-        size_t size = 0;
-        for (size_t i = 0; i < size_; i++) {
-            if (vals_[i] == true) {
-                size++;
-            }
+        size_t count = 0;
+        for (size_t w = 0; w < nwords_; w++) {
+            count += __builtin_popcountll(words_[w]);
         }
-        return size;
+        return count;
     }
 
-    /** Performs set union in place. */
-    void union_(Set &from) {
-        for (size_t i = 0; i < from.size_; i++)
-            if (from.test(i))
-                set(i);
+    /** Returns the smallest element >= idx, size() if there is none. */
+    size_t next(size_t idx) {
+        if (idx >= size_) return size_;
+        size_t w = idx >> 6;
+        uint64_t bits = words_[w] & (~(uint64_t) 0 << (idx & 63));
+        while (bits == 0) {
+            if (++w == nwords_) return size_;
+            bits = words_[w];
+        }
+        return (w << 6) + __builtin_ctzll(bits);
     }
-};
 
-/*****************************************************************************
- * A SetWriter copies all the values present in the set into a one-column
- * dataframe. The data contains all the values in the set. The dataframe has
- * at least one integer column.
- ****************************************************************************/
-class SetWriter : public Writer {
-public:
-    Set &set_; // set to read from
-    int i_ = 0;  // position in set
+    /** Performs set union in place; elements of from past size() are
+     *  ignored. */
+    void union_(Set &from) {
+        size_t n = from.nwords_ < nwords_ ? from.nwords_ : nwords_;
+        for (size_t w = 0; w < n; w++) words_[w] |= from.words_[w];
+        trim_();
+    }
 
-    SetWriter(Set &set) : set_(set) {
+    /** Keeps only the elements that are also in from. */
+    void intersect_(Set &from) {
+        size_t n = from.nwords_ < nwords_ ? from.nwords_ : nwords_;
+        for (size_t w = 0; w < n; w++) words_[w] &= from.words_[w];
+        for (size_t w = n; w < nwords_; w++) words_[w] = 0;
     }
 
-    /** Skip over false values and stop when the entire set has been seen */
-    virtual bool done() override {
-        while (i_ < set_.size_ && set_.test(i_) == false) ++i_;
-        return i_ == set_.size_;
+    /** Removes the elements that are in from. */
+    void difference_(Set &from) {
+        size_t n = from.nwords_ < nwords_ ? from.nwords_ : nwords_;
+        for (size_t w = 0; w < n; w++) words_[w] &= ~from.words_[w];
     }
 
-    virtual void visit(Row &row) override { row.set(0, i_++); }
+    /** Clears the bits of the last word past size() */
+    void trim_() {
+        if (size_ & 63) words_[nwords_ - 1] &= ((uint64_t) 1 << (size_ & 63)) - 1;
+    }
 };
 
-
 /*******************************************************************************
- * A SetUpdater is a reader that gets the first column of the data frame and
- * sets the corresponding value in the given set.
+ * A SetCodec turns a Set into a one-column int dataframe, to be sent to
+ * other nodes, and back. The encoding is chosen per set, whichever is
+ * smaller:
+ *   - a bitmap: the words of the set from its first to its last non-zero
+ *     word, for dense sets;
+ *   - a varint list: the elements in order, each as its distance to the
+ *     previous one, 7 bits per byte, for sparse sets.
+ * The ints of the column are: the kind, then two ints giving the first word
+ * and the number of words of a bitmap, or the bytes and the number of
+ * elements of a list, then the payload packed into ints.
  ******************************************************************************/
-class SetUpdater : public Reader {
+class SetCodec {
 public:
-    Set &set_; // set to update
-
-    SetUpdater(Set &set) : set_(set) {}
-
-    /** Assume a row with at least one column of type I. Assumes that there
-     * are no missing. Reads the value and sets the corresponding position.
-     * The return value is irrelevant here. */
-    bool visit(Row &row) {
-        set_.set(row.get_int(0));
-        return false;
+    static const int BITMAP = 0;
+    static const int VARINT = 1;
+
+    /** Returns the bytes of the varint list of the elements of set */
+    static size_t varint_bytes_(Set &set) {
+        size_t bytes = 0;
+        size_t prev = 0;
+        for (size_t i = set.next(0); i < set.size(); i = set.next(i + 1)) {
+            for (size_t gap = i - prev; ; gap >>= 7) {
+                bytes++;
+                if (gap < 128) break;
+            }
+            prev = i;
+        }
+        return bytes;
+    }
+
+    /** Returns a new dataframe encoding the elements of set */
+    static DataFrame *encode(Set &set) {
+        size_t first = 0;
+        while (first < set.nwords_ && set.words_[first] == 0) first++;
+        size_t last = set.nwords_;
+        while (last > first && set.words_[last - 1] == 0) last--;
+        size_t list = varint_bytes_(set);
+
+        vector<int> out;
+        if ((last - first) * sizeof(uint64_t) <= list) {
+            out.resize(3 + 2 * (last - first));
+            out[0] = BITMAP;
+            out[1] = (int) first;
+            out[2] = (int) (last - first);
+            memcpy(out.data() + 3, set.words_ + first, (last - first) * sizeof(uint64_t));
+        } else {
+            out.resize(3 + (list + sizeof(int) - 1) / sizeof(int));
+            out[0] = VARINT;
+            out[1] = (int) list;
+            out[2] = (int) set.num_true();
+            unsigned char *bytes = (unsigned char *) (out.data() + 3);
+            size_t prev = 0;
+            for (size_t i = set.next(0); i < set.size(); i = set.next(i + 1)) {
+                size_t gap = i - prev;
+                for (; gap >= 128; gap >>= 7) *bytes++ = (unsigned char) (gap | 128);
+                *bytes++ = (unsigned char) gap;
+                prev = i;
+            }
+        }
+        Schema scm("I");
+        DataFrame *df = new DataFrame(scm);
+        df->columns[0]->as_int()->vals_.push_back(out.data(), out.size());
+        return df;
     }
 
+    /** Adds to set the elements encoded in df; the words of a bitmap are
+     *  ORed into those of set. */
+    static void decode_into(DataFrame *df, Set &set) {
+        IntColumn *col = df->columns[0]->as_int();
+        vector<int> in(col->size());
+        for (size_t i = 0; i < in.size(); i++) in[i] = col->get(i);
+        assert(in.size() >= 3);
+        if (in[0] == BITMAP) {
+            size_t first = in[1];
+            size_t n = in[2];
+            assert(first + n <= set.nwords_ && in.size() >= 3 + 2 * n);
+            const uint64_t *words = (const uint64_t *) (in.data() + 3);
+            for (size_t w = 0; w < n; w++) {
+                uint64_t word;
+                memcpy(&word, words + w, sizeof(word));
+                set.words_[first + w] |= word;
+            }
+            set.trim_();
+        } else {
+            const unsigned char *bytes = (const unsigned char *) (in.data() + 3);
+            const unsigned char *end = bytes + in[1];
+            size_t cur = 0;
+            while (bytes < end) {
+                size_t gap = 0;
+                for (size_t shift = 0; ; shift += 7) {
+                    gap |= (size_t) (*bytes & 127) << shift;
+                    if (!(*bytes++ & 128)) break;
+                }
+                cur += gap;
+                set.set(cur);
+            }
+        }
+    }
 };
 
-
 /***************************************************************************
  * The ProjectTagger is a reader that is mapped over commits, and marks all
  * of the projects to which a collaborator of Linus committed as an author.
@@ -437,20 +598,30 @@ public:
     ProjectsTagger(Set &uSet, Set &pSet, DataFrame *proj) :
             uSet(uSet), pSet(pSet), newProjects(proj) {}
 
+    ProjectsTagger(Set &uSet, Set &pSet, size_t nprojects) :
+            uSet(uSet), pSet(pSet), newProjects(nprojects) {}
+
     /** The data frame must have at least two integer columns. The newProject
      * set keeps track of projects that were newly tagged (they will have to
-     * be communicated to other nodes). */
+     * be communicated to other nodes). uSet and pSet are only read, so that
+     * clones can share them; the caller adds newProjects to pSet. */
     bool visit(Row &row) override {
         int pid = row.get_int(0);
         int uid = row.get_int(1);
-        if (uSet.test(uid)) {
-            if (!pSet.test(pid)) {
-                pSet.set(pid);
-                newProjects.set(pid);
-                return true;
-            }
-            return false;
+        if (uSet.test(uid) && !pSet.test(pid) && !newProjects.test(pid)) {
+            newProjects.set(pid);
+            return true;
         }
+        return false;
+    }
+
+    Rower *clone() override {
+        return new ProjectsTagger(uSet, pSet, newProjects.size());
+    }
+
+    void join_delete(Rower *other) override {
+        newProjects.union_(dynamic_cast<ProjectsTagger *>(other)->newProjects);
+        delete other;
     }
 };
 
@@ -472,16 +643,27 @@ public:
             pSet(pSet), uSet(uSet), newUsers(users->get_num_rows()) {
     }
 
+    UsersTagger(Set &pSet, Set &uSet, size_t nusers) :
+            pSet(pSet), uSet(uSet), newUsers(nusers) {
+    }
+
+    /** uSet and pSet are only read, the caller adds newUsers to uSet. */
     bool visit(Row &row) override {
         int pid = row.get_int(0);
         int uid = row.get_int(1);
-        if (pSet.test(pid)) {
-            if (!uSet.test(uid)) {
-                uSet.set(uid);
-                newUsers.set(uid);
-                return true;
-            }
-            return false;
+        if (pSet.test(pid) && !uSet.test(uid) && !newUsers.test(uid)) {
+            newUsers.set(uid);
+            return true;
         }
+        return false;
+    }
+
+    Rower *clone() override {
+        return new UsersTagger(pSet, uSet, newUsers.size());
+    }
+
+    void join_delete(Rower *other) override {
+        newUsers.union_(dynamic_cast<UsersTagger *>(other)->newUsers);
+        delete other;
     }
 };
@@ -5,6 +5,11 @@
  * dataframe's schema. The purpose of this class is to make it easier to add
  * read/write complete rows. Internally a dataframe hold data in columns.
  * Rows have pointer equality.
+ *
+ * Fields are stored unboxed and setting one never allocates, so a single
+ * row can be reused as a cursor over all the rows of a dataframe. String
+ * fields are either owned Strings or views over chars owned by someone
+ * else (a column or a buffer), see set_view().
  */
 
 #pragma once
@@ -23,88 +28,102 @@
 #include "../fielder.h"
 #include "iostream"
 
+/** The value of a field that is not a string. */
+union Field {
+    int i;
+    float f;
+    bool b;
+};
+
 class Row : public Object {
 public:
-    Object **elements;
     size_t size;
     size_t index;
+    char *types;            // owned; type of each field
+    Field *vals;            // owned; int, float and bool fields
+    String **strs;          // owned; string fields, either a view or owned
+    MutableString **views;  // owned; reusable view of each string field
+    int *codes;     // owned; dictionary code of each string field, -1 if not encoded
+    size_t *dicts;  // owned; dictionary each code belongs to
 
     /** Build a row following a schema. */
     Row(Schema *scm) {
-        this->elements = new Object *[10];
         index = 0;
         size = scm->get_num_cols();
-        for (size_t i = 0; i < scm->get_num_cols(); i++) {
-            char type = scm->types->at(i);
-            switch (type) {
-                case 'F':
-                    elements[i] = new Float(0);
-                    break;
-                case 'B':
-                    elements[i] = new Bool(0);
-                    break;
-                case 'I':
-                    elements[i] = new Integer(0);
-                    break;
-                case 'S':
-                    elements[i] = new String("");
-                    break;
-            }
+        types = new char[size];
+        vals = new Field[size];
+        strs = new String *[size];
+        views = new MutableString *[size];
+        codes = new int[size];
+        dicts = new size_t[size];
+        for (size_t i = 0; i < size; i++) {
+            types[i] = scm->col_type(i);
+            vals[i].i = 0;
+            views[i] = types[i] == 'S' ? new MutableString() : nullptr;
+            strs[i] = views[i];
+            codes[i] = -1;
+            dicts[i] = 0;
         }
     }
 
     ~Row() {
-        for (int i = 0; i < size; i++) {
-            delete elements[i];
+        for (size_t i = 0; i < size; i++) {
+            release_(i);
+            delete views[i];
+        }
+        delete[] types;
+        delete[] vals;
+        delete[] strs;
+        delete[] views;
+        delete[] codes;
+        delete[] dicts;
+    }
+
+    /** Deletes the string of the given field if the row owns it */
+    void release_(size_t col) {
+        if (strs[col] != views[col]) {
+            delete strs[col];
+            strs[col] = views[col];
         }
-        delete[] elements;
     }
 
     /** Setters: set the given column with the given value. Setting a column with
       * a value of the wrong type is undefined. */
     void set(size_t col, int val) {
-        if (col < size && col >= 0) {
-            if (elements[col] != nullptr) {
-                delete elements[col];
-            }
-            elements[col] = new Integer(val);
-        } else {
-            exit(1);
-        }
+        if (col >= size) exit(1);
+        vals[col].i = val;
     }
 
     void set(size_t col, float val) {
-        if (col < size && col >= 0) {
-            if (elements[col] != nullptr) {
-                delete elements[col];
-            }
-            elements[col] = new Float(val);
-        } else {
-            exit(1);
-        }
+        if (col >= size) exit(1);
+        vals[col].f = val;
     }
 
     void set(size_t col, bool val) {
-        if (col < size && col >= 0) {
-            if (elements[col] != nullptr) {
-                delete elements[col];
-            }
-            elements[col] = new Bool(val);
-        } else {
-            exit(1);
-        }
+        if (col >= size) exit(1);
+        vals[col].b = val;
     }
 
-    /** The string is external. */
+    /** The string is owned by the row. */
     void set(size_t col, String *val) {
-        if (col < size && col >= 0) {
-            if (elements[col] != nullptr) {
-                delete elements[col];
-            }
-            elements[col] = val;
-        } else {
-            exit(1);
-        }
+        if (col >= size) exit(1);
+        release_(col);
+        strs[col] = val;
+        codes[col] = -1;
+        dicts[col] = 0;
+    }
+
+    /** Sets a string field to a view of len zero terminated chars that the
+      * row does not own; they must stay valid until the field is set again.
+      * A hash of 0 means the hash is computed when needed. The code and
+      * dict are those of a dictionary encoded column, -1 and 0 otherwise. */
+    void set_view(size_t col, const char *chars, size_t len, size_t hash,
+                  int code, size_t dict) {
+        if (col >= size) exit(1);
+        release_(col);
+        views[col]->become(chars, len, hash);
+        codes[col] = code;
+        dicts[col] = dict;
     }
 
     /** Set/get the index of this row (ie. its position in the dataframe. This is
@@ -120,23 +139,30 @@ public:
     /** Getters: get the value at the given column. If the column is not
       * of the requested type, the result is undefined. */
     int get_int(size_t col) {
-        Integer *v = dynamic_cast<Integer *>(elements[col]);
-        return v->val;
+        return vals[col].i;
     }
 
     bool get_bool(size_t col) {
-        bool v = dynamic_cast<Bool *>(elements[col])->val;
-        return v;
+        return vals[col].b;
     }
 
     float get_float(size_t col) {
-        float v = dynamic_cast<Float *>(elements[col])->val;
-        return v;
+        return vals[col].f;
     }
 
+    /** The string is owned by the row, or viewed by it. */
     String *get_string(size_t col) {
-        String *v = (String *) elements[col];
-        return v;
+        return strs[col];
+    }
+
+    /** Dictionary code of a string field, -1 if it is not encoded. Codes are
+      * only comparable between fields with the same get_dict(). */
+    int get_code(size_t col) {
+        return codes[col];
+    }
+
+    size_t get_dict(size_t col) {
+        return dicts[col];
     }
 
     /** Number of fields in the row. */
@@ -146,15 +172,7 @@ public:
 
     /** Type of the field at the given position. An idx >= width is  undefined. */
     char col_type(size_t idx) {
-        if (dynamic_cast<Integer *>(this->elements[idx])) {
-            return 'I';
-        } else if (dynamic_cast<Bool *>(this->elements[idx])) {
-            return 'B';
-        } else if (dynamic_cast<Float *>(this->elements[idx])) {
-            return 'F';
-        } else {
-            return 'S';
-        }
+        return types[idx];
     }
 
     /** Given a Fielder, visit every field of this row. The first argument is
@@ -202,4 +220,4 @@ public:
         cout << " |" << endl;
     }
 
-};
\ No newline at end of file
+};
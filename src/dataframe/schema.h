@@ -78,11 +78,13 @@ public:
     /** Appends the given char to this Schema's types String */
     void append(char s) {
         int newsize = 1 + this->types->size();
-        char *newArr = new char[newsize];
+        char *newArr = new char[newsize + 1];
         for (int i = 0; i < this->types->size(); i++) {
             newArr[i] = this->types->at(i);
         }
         newArr[this->types->size()] = s;
-        this->types = new String(newArr);
+        newArr[newsize] = 0;
+        delete this->types;
+        this->types = new String(true, newArr, newsize);
     }
 };
\ No newline at end of file
@@ -0,0 +1,177 @@
+/*************************************************************************
+ * Snapshot ::
+ * A parsed DataFrame saved next to the sor file it was parsed from, so that
+ * later runs map it instead of parsing the text again. The file holds a
+ * SnapshotHeader followed by the DataFrame in the binary columnar encoding
+ * of serialize_df(): the schema, then the values of each column in one
+ * contiguous run, aligned on BIN_ALIGN bytes.
+ *
+ * A snapshot is only used when it was made from a source file of the same
+ * size and modification time, and when its body still has the hash
+ * recorded in the header; otherwise the source is parsed again and the
+ * snapshot rewritten.
+ *
+ * Snapshots are opt-in (-snapshot true). They are written in the directory
+ * of the sor file, one per part and number of nodes, and are never
+ * removed: delete the .snap files next to a dataset to reclaim the space.
+ */
+#pragma once
+
+#include "dataframe.h"
+#include "../network/serial.h"
+#include "../CS4500NE/parser.h"
+#include "../mapped.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+
+/** Identifies a snapshot file and the version of its format. */
+static const char SNAPSHOT_MAGIC[8] = {'E', 'A', 'U', '2', 'S', 'N', 'P', '1'};
+
+/** First bytes of a snapshot file. */
+struct SnapshotHeader {
+    char magic[8];         // SNAPSHOT_MAGIC
+    uint64_t source_size;  // bytes of the sor file
+    uint64_t source_mtime; // modification time of the sor file, in nanoseconds
+    uint64_t body_size;    // bytes following the header
+    uint64_t body_hash;    // SnapshotHash of those bytes
+};
+
+/** A hash of a run of bytes given in pieces, eight bytes at a time. */
+class SnapshotHash {
+public:
+    uint64_t hash_;
+    uint64_t word_;  // bytes of a word not complete yet
+    size_t filled_;  // bytes in word_
+
+    SnapshotHash() {
+        hash_ = 14695981039346656037ULL;
+        word_ = 0;
+        filled_ = 0;
+    }
+
+    void mix_(uint64_t w) {
+        hash_ = (hash_ ^ w) * 1099511628211ULL;
+        hash_ ^= hash_ >> 29;
+    }
+
+    void add(const char *bytes, size_t len) {
+        while (len > 0 && filled_ != 0) {
+            add_byte_(*bytes++);
+            len--;
+        }
+        for (; len >= sizeof(uint64_t); len -= sizeof(uint64_t), bytes += sizeof(uint64_t)) {
+            uint64_t w;
+            memcpy(&w, bytes, sizeof(w));
+            mix_(w);
+        }
+        while (len-- > 0) add_byte_(*bytes++);
+    }
+
+    void add_byte_(char c) {
+        word_ |= (uint64_t) (unsigned char) c << (8 * filled_);
+        if (++filled_ == sizeof(uint64_t)) {
+            mix_(word_);
+            word_ = 0;
+            filled_ = 0;
+        }
+    }
+
+    uint64_t get() {
+        return filled_ == 0 ? hash_ : (hash_ ^ word_) * 1099511628211ULL + filled_;
+    }
+};
+
+/** Returns the modification time of a file in nanoseconds */
+static uint64_t snapshotMtime(struct stat &st) {
+    return (uint64_t) st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+}
+
+/**
+ * Writes df to a snapshot at path, made from the source file described by
+ * source. The file is written under a temporary name and renamed, so that
+ * nodes sharing a directory never see half a snapshot. Returns false if it
+ * could not be written.
+ */
+static bool writeSnapshot(const char *path, DataFrame *df, struct stat &source) {
+    Gather body;
+    serialize_df(body, df);
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.source_size = source.st_size;
+    header.source_mtime = snapshotMtime(source);
+    header.body_size = body.size_;
+    SnapshotHash hash;
+    for (size_t i = 0; i < body.iov_.size(); i++) {
+        hash.add((const char *) body.iov_[i].iov_base, body.iov_[i].iov_len);
+    }
+    header.body_hash = hash.get();
+
+    std::string tmp = std::string(path) + "." + std::to_string(getpid()) + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    bool ok = write(fd, &header, sizeof(header)) == sizeof(header) && body.write_to(fd);
+    ok = close(fd) == 0 && ok;
+    if (ok) ok = rename(tmp.c_str(), path) == 0;
+    if (!ok) unlink(tmp.c_str());
+    return ok;
+}
+
+/**
+ * Maps the snapshot at path and returns its DataFrame, or nullptr if there
+ * is no snapshot there or it does not match the source file described by
+ * source.
+ */
+static DataFrame *readSnapshot(const char *path, struct stat &source) {
+    struct stat st;
+    if (stat(path, &st) != 0 || (size_t) st.st_size < sizeof(SnapshotHeader)) return nullptr;
+    MappedFile file(path);
+    SnapshotHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.source_size != (uint64_t) source.st_size ||
+        header.source_mtime != snapshotMtime(source) ||
+        header.body_size != file.size() - sizeof(header)) {
+        return nullptr;
+    }
+    const char *body = file.data() + sizeof(header);
+    SnapshotHash hash;
+    hash.add(body, header.body_size);
+    if (hash.get() != header.body_hash) return nullptr;
+
+    BufScatter in(body, 0, header.body_size);
+    DataFrame *df = deserialize_df(in);
+    if (in.failed_ || in.left_ != 0) {
+        delete df;
+        return nullptr;
+    }
+    return df;
+}
+
+/**
+ * Returns the DataFrame of part i of n parts of the sor file at path (see
+ * MappedFile::part(), the whole file by default), from its snapshot when
+ * there is a valid one, else parsed on threads threads, in which case the
+ * snapshot is written for the next run if snapshot is true. The snapshot
+ * of the whole file is path.snap, that of a part path.<i>-<n>.snap.
+ * Nothing is read or written besides the sor file if snapshot is false.
+ */
+static DataFrame *loadSorFile(const char *path, size_t threads, bool snapshot = false,
+                              size_t i = 0, size_t n = 1) {
+    struct stat source;
+    int res = stat(path, &source);
+    assert(res == 0 && "Unable to open file");
+    std::string snap = std::string(path) + ".snap";
+    if (n > 1) {
+        snap = std::string(path) + "." + std::to_string(i) + "-" + std::to_string(n) + ".snap";
+    }
+    DataFrame *df = snapshot ? readSnapshot(snap.c_str(), source) : nullptr;
+    if (df != nullptr) return df;
+    df = parseSorPart(path, i, n, threads);
+    if (snapshot && !writeSnapshot(snap.c_str(), df, source)) {
+        cout << "Unable to write snapshot " << snap << endl;
+    }
+    return df;
+}
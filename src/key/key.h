@@ -10,7 +10,7 @@
 
 /**
  * Represents a String, home Node association
- * To be used in a KVStore
+ * To be used in a KVStore, the value of a key is stored on its home node.
  */
 class Key : public Object {
 public:
@@ -27,19 +27,32 @@ public:
         this->home = arg.index;
     }
 
+    /** A key homed on this node */
     Key(const char *name) {
         this->name = new String(name);
-        this->home = 0;
+        this->home = arg.index;
     }
 
+    /** Copies the given key, name included */
     Key(Key *orig) {
-        this->name = orig->name;
+        this->name = orig->name->clone();
         this->home = orig->home;
     }
 
+    Key(const Key &orig) : Object(orig) {
+        this->name = orig.name->clone();
+        this->home = orig.home;
+    }
+
+    /** A key homed on this node, named by s; s is now owned by the key */
     Key(String *s) {
         this->name = s;
-        this->home = 0;
+        this->home = arg.index;
+    }
+
+    Key(String *s, size_t home) {
+        this->name = s;
+        this->home = home;
     }
 
     ~Key() {
@@ -59,17 +72,18 @@ public:
         return ret;
     }
 
-    /** Returns the name of this key **/
+    /** Returns the name of this key; owned by the key **/
     char *c_str()  {
-        StrBuff *a = new StrBuff();
-        a->c(this->name->c_str());
-        char *ret = a->get()->c_str();
-        return ret;
+        return this->name->c_str();
+    }
+
+    /** Returns the hash of the name of this key */
+    size_t hash_me() {
+        return name->hash();
     }
 
     Key* clone() {
-        Key* key = new Key(this->name);
-        return key;
+        return new Key(this);
     }
 
 };
@@ -6,83 +6,402 @@
 
 #include "../dataframe/dataframe.h"
 #include "key.h"
+#include "../network/thread.h"
+#include "../network/network.h"
 #include <iostream>
 #include <unistd.h>
 #include <cstdlib>
+#include <chrono>
+#include <vector>
+#include <map>
+#include <set>
 
 using namespace std;
 
+/** Slots of a new KVStore, a power of two. */
+static const size_t KV_FIRST = 64;
+
 /**
- * Represents a Key Value Store
+ * Represents a Key Value Store. Keys are found in an open addressing table
+ * indexed by the hash of their name, with linear probing; the table doubles
+ * when it is half full. The store owns its copies of the keys and the
+ * DataFrames put in it.
+ *
+ * The store can be shared between threads: every operation takes lock_,
+ * and put() wakes up the threads blocked in waitAndGet().
+ *
+ * Once connected to a network, the store is one part of a distributed
+ * store: the value of a key lives on the key's home node. put, get and
+ * waitAndGet of a key homed elsewhere are sent to its home node, and the
+ * store serves the requests of the other nodes on the network's receiver
+ * thread. The DataFrame fetched for a key homed elsewhere is kept here as
+ * this node's copy and returned by the following gets of the key until
+ * erase() drops it, so a pointer returned for it stays valid until then;
+ * a key whose value changes must be erased before it is fetched again.
  */
-class KVStore {
+class KVStore : public MessageHandler {
 public:
-    Key **keys;
-    DataFrame **dfs;
-    int size;
+    Key **keys;        // owned; nullptr for an empty slot
+    DataFrame **dfs;   // owned; DataFrame of the key in the same slot
+    size_t *hashes;    // hash of the key in the same slot
+    size_t capacity;   // number of slots
+    size_t size;       // number of keys
+    Lock lock_;        // guards everything below, notified on every put
+    NetworkIP *net_;   // external; nullptr when the store is not distributed
+    size_t next_id_;   // id of the next Get sent
+    set<size_t> awaited_;              // ids of the Gets sent and not answered
+    map<size_t, DataFrame *> replies_; // owned; answers to awaited Gets
+    vector<Get *> waiters_;            // owned; WaitAndGets of missing keys
 
     KVStore() {
+        this->net_ = nullptr;
+        this->next_id_ = 1;
         this->size = 0;
-        this->keys = new Key *[500];
-        this->dfs = new DataFrame *[500];
+        this->capacity = KV_FIRST;
+        this->keys = new Key *[capacity];
+        this->dfs = new DataFrame *[capacity];
+        this->hashes = new size_t[capacity];
+        for (size_t i = 0; i < capacity; i++) {
+            keys[i] = nullptr;
+        }
     }
 
     ~KVStore() {
-        cout << "in kv des" << endl;
-        cout << this->size << endl;
-        for (int i = 0; i < size; i++) {
+        for (size_t i = 0; i < capacity; i++) {
+            if (keys[i] != nullptr) {
                 delete keys[i];
-        }
-        cout << "done w keys" << endl;
-        for (int i = 0; i < size; i++) {
-            if (dfs[i] != nullptr) {
                 delete dfs[i];
             }
         }
-        cout << "done with ind" << endl;
         delete[] keys;
         delete[] dfs;
+        delete[] hashes;
+        for (auto &r : replies_) delete r.second;
+        for (size_t i = 0; i < waiters_.size(); i++) delete waiters_[i];
     };
 
+    /** Makes this store the part homed on this node of a distributed store.
+     *  The network's receiver thread must be stopped before the store is
+     *  deleted. */
+    void connect(NetworkIP *net) {
+        net_ = net;
+        net->start(this);
+    }
+
+    /** Is the key homed on another node */
+    bool remote_(Key &key) {
+        return net_ != nullptr && key.home != net_->index();
+    }
+
+    /** Returns the slot of the given key, or of the empty slot where it would
+     *  be added if it is not in the store */
+    size_t find_(Key &key, size_t hash) {
+        size_t mask = capacity - 1;
+        size_t i = hash & mask;
+        while (keys[i] != nullptr) {
+            if (hashes[i] == hash && key.equals(keys[i])) return i;
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+    /** Doubles the number of slots */
+    void grow_() {
+        Key **oldKeys = keys;
+        DataFrame **oldDfs = dfs;
+        size_t *oldHashes = hashes;
+        size_t oldCapacity = capacity;
+        capacity *= 2;
+        keys = new Key *[capacity];
+        dfs = new DataFrame *[capacity];
+        hashes = new size_t[capacity];
+        for (size_t i = 0; i < capacity; i++) {
+            keys[i] = nullptr;
+        }
+        for (size_t i = 0; i < oldCapacity; i++) {
+            if (oldKeys[i] == nullptr) continue;
+            size_t j = find_(*oldKeys[i], oldHashes[i]);
+            keys[j] = oldKeys[i];
+            dfs[j] = oldDfs[i];
+            hashes[j] = oldHashes[i];
+        }
+        delete[] oldKeys;
+        delete[] oldDfs;
+        delete[] oldHashes;
+    }
+
     /**
-     * Adds the given Key and DataFrame to this KVStore
+     * Adds the given Key and DataFrame to this KVStore. The key is copied,
+     * the DataFrame is now owned by the store. If the key was already there
+     * its previous DataFrame is deleted, unless it is the one given. A key
+     * homed on another node is sent there and df is deleted.
      */
     void put(Key *key, DataFrame *df) {
-        cout << "size of kv: " << size << "new key: " << key->name->c_str() << endl;
-
-        // check if key is already there
-        for (size_t k = 0; k < size; k++) {
-            // if found already, replace
-            if (this->keys[k]->equals(key)) {
-                this->dfs[k] = df;
-                return;
-            }
+        if (remote_(*key)) {
+            Put msg(net_->index(), key, df);
+            net_->send_m(&msg);
+            return;
         }
+        put_local_(key, df);
+    }
 
-        // if new key add and increment size
-        this->keys[size] = key;
-        this->dfs[size] = df;
+    /** Stores the key here and answers the nodes waiting for it; the
+     *  answers go to the network's outbox, this may run on the receiver
+     *  thread */
+    void put_local_(Key *key, DataFrame *df) {
+        size_t hash = key->hash();
+        vector<size_t> targets;
+        vector<Gather *> answers;
+        lock_.lock();
+        insert_(*key, hash, df);
+        for (size_t w = 0; w < waiters_.size();) {
+            if (waiters_[w]->key_->equals(key)) {
+                targets.push_back(waiters_[w]->sender_);
+                answers.push_back(answer_(waiters_[w], df));
+                delete waiters_[w];
+                waiters_.erase(waiters_.begin() + w);
+            } else {
+                w++;
+            }
+        }
+        lock_.notify_all();
+        lock_.unlock();
+        for (size_t w = 0; w < targets.size(); w++) {
+            net_->post_gather(targets[w], answers[w]);
+        }
+    }
 
+    /** Stores df under the key, replacing and deleting the previous
+     *  DataFrame unless it is df; lock_ is held */
+    void insert_(Key &key, size_t hash, DataFrame *df) {
+        size_t i = find_(key, hash);
+        if (keys[i] != nullptr) {
+            if (dfs[i] != df) delete dfs[i];
+            dfs[i] = df;
+            return;
+        }
+        keys[i] = key.clone();
+        dfs[i] = df;
+        hashes[i] = hash;
         size++;
-        cout << "put done new size: " << size << endl;
+        if (size * 2 > capacity) grow_();
+    }
+
+    /** Returns the Reply to the given Get, gathered with copies of the
+     *  columns since the DataFrame belongs to the store; lock_ is held. */
+    Gather *answer_(Get *get, DataFrame *df) {
+        Reply reply(net_->index(), get->sender_, get->id_, df);
+        Gather *res = new Gather();
+        reply.gather(*res);
+        res->own();
+        reply.df_ = nullptr;
+        return res;
     }
 
     /**
-     * Returns the DataFrame associated in this KVStore with the given Key
+     * Returns this node's copy of a key homed elsewhere. If there is none,
+     * asks the home node for its DataFrame and waits for the answer, at most
+     * millis milliseconds if millis is not 0; a WaitAndGet that times out is
+     * withdrawn from the home node. The DataFrame received becomes the copy
+     * and is returned, it is owned by the store; nullptr if there was none
+     * or the time ran out.
      */
-    DataFrame *get(Key key) {
-        for (int i = 0; i < size; i++) {
-            if (key.equals(keys[i])) {
-                return dfs[i];
+    DataFrame *fetch_(Key &key, MsgKind kind, size_t millis) {
+        std::chrono::steady_clock::time_point deadline =
+                std::chrono::steady_clock::now() + std::chrono::milliseconds(millis);
+        size_t hash = key.hash();
+        lock_.lock();
+        DataFrame *copy = get_(key);
+        if (copy != nullptr) {
+            lock_.unlock();
+            return copy;
+        }
+        size_t id = next_id_++;
+        awaited_.insert(id);
+        lock_.unlock();
+        Get msg(kind, net_->index(), &key, id);
+        net_->send_m(&msg);
+        lock_.lock();
+        while (replies_.count(id) == 0) {
+            if (millis == 0) {
+                lock_.wait();
+            } else if (!lock_.wait_until(deadline)) {
+                break;
             }
         }
+        awaited_.erase(id); // a late reply is dropped
+        bool answered = replies_.count(id) != 0;
+        DataFrame *df = nullptr;
+        if (answered) {
+            df = replies_[id];
+            replies_.erase(id);
+            copy = get_(key); // fetched by another thread meanwhile
+            if (copy != nullptr) {
+                delete df;
+                df = copy;
+            } else if (df != nullptr) {
+                insert_(key, hash, df);
+            }
+        }
+        lock_.unlock();
+        if (!answered && kind == MsgKind::WaitAndGet) {
+            Get cancel(MsgKind::Cancel, net_->index(), &key, id);
+            net_->send_m(&cancel);
+        }
+        return df;
+    }
 
+    /** Serves the store messages of the other nodes, on the network's
+     *  receiver thread; answers are posted, never written from here */
+    bool handle(Message *msg) {
+        switch (msg->kind_) {
+            case MsgKind::Put: {
+                Put *p = dynamic_cast<Put *>(msg);
+                put_local_(p->key_, p->df_);
+                p->df_ = nullptr;
+                delete p;
+                return true;
+            }
+            case MsgKind::Get:
+            case MsgKind::WaitAndGet: {
+                Get *g = dynamic_cast<Get *>(msg);
+                lock_.lock();
+                DataFrame *df = get_(*g->key_);
+                if (df == nullptr && g->kind_ == MsgKind::WaitAndGet) {
+                    waiters_.push_back(g); // answered by put_local_
+                    lock_.unlock();
+                    return true;
+                }
+                Gather *answer = answer_(g, df);
+                lock_.unlock();
+                net_->post_gather(g->sender_, answer);
+                delete g;
+                return true;
+            }
+            case MsgKind::Cancel: {
+                Get *c = dynamic_cast<Get *>(msg);
+                lock_.lock();
+                for (size_t w = 0; w < waiters_.size(); w++) {
+                    if (waiters_[w]->sender_ == c->sender_ && waiters_[w]->id_ == c->id_) {
+                        delete waiters_[w];
+                        waiters_.erase(waiters_.begin() + w);
+                        break;
+                    }
+                }
+                lock_.unlock();
+                delete c;
+                return true;
+            }
+            case MsgKind::Reply: {
+                Reply *r = dynamic_cast<Reply *>(msg);
+                lock_.lock();
+                if (awaited_.count(r->id_) != 0) {
+                    replies_[r->id_] = r->df_;
+                    r->df_ = nullptr;
+                    lock_.notify_all();
+                }
+                lock_.unlock();
+                delete r;
+                return true;
+            }
+            default:
+                return false;
+        }
+    }
+
+    /** Returns the DataFrame of the key, nullptr if absent; lock_ is held */
+    DataFrame *get_(Key &key) {
+        size_t i = find_(key, key.hash());
+        return keys[i] == nullptr ? nullptr : dfs[i];
+    }
+
+    /**
+     * Returns the DataFrame associated in this KVStore with the given Key,
+     * nullptr if there is none. The DataFrame is owned by the store; for a
+     * key homed elsewhere it is this node's copy, see fetch_().
+     */
+    DataFrame *get(Key &key) {
+        if (remote_(key)) return fetch_(key, MsgKind::Get, 0);
+        lock_.lock();
+        DataFrame *df = get_(key);
+        lock_.unlock();
+        return df;
+    }
+
+    DataFrame *get(Key *key) {
+        return get(*key);
+    }
+
+    /**
+     * Removes the given Key from this KVStore and deletes its DataFrame. The
+     * keys that follow it in their probe sequence are shifted back, so that
+     * the table never needs tombstones. Only the copy held by this node is
+     * removed.
+     */
+    void erase(Key &key) {
+        lock_.lock();
+        size_t mask = capacity - 1;
+        size_t i = find_(key, key.hash());
+        if (keys[i] == nullptr) {
+            lock_.unlock();
+            return;
+        }
+        delete keys[i];
+        delete dfs[i];
+        keys[i] = nullptr;
+        size--;
+        for (size_t j = (i + 1) & mask; keys[j] != nullptr; j = (j + 1) & mask) {
+            size_t home = hashes[j] & mask;
+            // the key at j may move to i if i is on its way from home to j
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                keys[i] = keys[j];
+                dfs[i] = dfs[j];
+                hashes[i] = hashes[j];
+                keys[j] = nullptr;
+                i = j;
+            }
+        }
+        lock_.unlock();
+    }
+
+    /**
+     * Blocks until one of the given keys is in the store and returns its
+     * DataFrame, setting which to the index of the key. Waits at most millis
+     * milliseconds, 0 means forever; returns nullptr if the time ran out.
+     * The keys must be homed on this node.
+     */
+    DataFrame *waitAndGetAny(vector<Key *> &wanted, size_t &which, size_t millis = 0) {
+        std::chrono::steady_clock::time_point deadline =
+                std::chrono::steady_clock::now() + std::chrono::milliseconds(millis);
+        lock_.lock();
+        bool timed_out = false;
+        while (true) {
+            for (which = 0; which < wanted.size(); which++) {
+                DataFrame *df = get_(*wanted[which]);
+                if (df != nullptr) {
+                    lock_.unlock();
+                    return df;
+                }
+            }
+            if (timed_out) break;
+            if (millis == 0) {
+                lock_.wait();
+            } else {
+                timed_out = !lock_.wait_until(deadline);
+            }
+        }
+        lock_.unlock();
         return nullptr;
     }
 
-    /** Wait until we find the key **/
-    DataFrame *waitAndGet(Key key) {
-        return get(key);
+    /** Blocks until the key is in the store, at most millis milliseconds or
+     *  forever if millis is 0. Returns nullptr if the time ran out. A key
+     *  homed elsewhere is fetched as by get(). **/
+    DataFrame *waitAndGet(Key &key, size_t millis = 0) {
+        if (remote_(key)) return fetch_(key, MsgKind::WaitAndGet, millis);
+        vector<Key *> wanted(1, &key);
+        size_t which;
+        return waitAndGetAny(wanted, which, millis);
     }
 
-};
\ No newline at end of file
+};
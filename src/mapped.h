@@ -0,0 +1,76 @@
+#pragma once
+
+#include "object.h"
+#include <assert.h>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+/** A file mapped read-only into memory. Readers take views of its bytes
+ *  instead of copying them; the views are valid while the MappedFile is. */
+class MappedFile : public Object {
+public:
+    const char *data_;  // owned mapping; nullptr for an empty file
+    size_t size_;       // bytes of the file
+
+    MappedFile(const char *path) {
+        int fd = open(path, O_RDONLY);
+        assert(fd >= 0 && "Unable to open file");
+        struct stat st;
+        int res = fstat(fd, &st);
+        assert(res == 0);
+        size_ = st.st_size;
+        data_ = nullptr;
+        if (size_ > 0) {
+            void *map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            assert(map != MAP_FAILED && "Unable to map file");
+            madvise(map, size_, MADV_SEQUENTIAL);
+            data_ = (const char *) map;
+        }
+        close(fd); // the mapping keeps the file
+    }
+
+    ~MappedFile() {
+        if (data_ != nullptr) munmap((void *) data_, size_);
+    }
+
+    const char *data() { return data_; }
+
+    size_t size() { return size_; }
+
+    /** Returns the first line start at or after pos: pos itself if it
+     *  follows a newline, else the byte after the next newline, or size()
+     *  if there is none. */
+    size_t line_start(size_t pos) {
+        if (pos == 0) return 0;
+        if (pos >= size_) return size_;
+        const char *newline = (const char *) memchr(data_ + pos - 1, '\n', size_ - pos + 1);
+        return newline == nullptr ? size_ : newline - data_ + 1;
+    }
+
+    /** Sets start and end to the bytes of part i of n parts of the file of
+     *  about the same size, cut at line starts; a part may be empty. */
+    void part(size_t i, size_t n, size_t &start, size_t &end) {
+        start = line_start(size_ / n * i);
+        end = i + 1 == n ? size_ : line_start(size_ / n * (i + 1));
+    }
+
+    /** Cuts the bytes [begin, end), which start at a line start, at line
+     *  starts into up to n ranges of at least min_bytes each, for as many
+     *  threads. Returns the start of each range followed by end; no range
+     *  is empty, so there is none when begin == end. */
+    std::vector<size_t> ranges(size_t begin, size_t end, size_t n, size_t min_bytes) {
+        size_t max = (end - begin) / min_bytes;
+        if (n > max) n = max;
+        if (n == 0) n = 1;
+        std::vector<size_t> starts(1, begin);
+        for (size_t i = 1; i <= n; i++) {
+            size_t start = i == n ? end : line_start(begin + (end - begin) / n * i);
+            if (start > starts.back()) starts.push_back(start);
+        }
+        return starts;
+    }
+};
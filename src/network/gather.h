@@ -0,0 +1,243 @@
+/**************************************************************************
+ * Gather, Scatter ::
+ * The two ends of a message on the wire. A Gather lists the pieces of an
+ * outgoing message without joining them: large values, such as the
+ * segments of a column, are referenced where they live and written out
+ * with a single writev(), small ones (headers, lengths) are copied into
+ * staging blocks owned by the Gather. A Scatter hands out the bytes of an
+ * incoming message in order, copying them wherever the reader wants them,
+ * typically straight into the storage of a column.
+ *
+ * Binary values are aligned on BIN_ALIGN bytes from the start of the
+ * message, pad() and skip_pad() keep both ends in step.
+ */
+#pragma once
+
+#include "../wrappers/string.h"
+#include <sys/uio.h>
+#include <climits>
+#include <cstdint>
+#include <unistd.h>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+/** Bytes the binary values of a message are aligned to. */
+static const size_t BIN_ALIGN = 8;
+/** Bytes of a staging block of a Gather. */
+static const size_t GATHER_BLOCK = 16 * 1024;
+/** Pieces shorter than this are copied rather than referenced. */
+static const size_t GATHER_MIN_REF = 256;
+
+class Gather : public Object {
+public:
+    vector<iovec> iov_;      // the pieces of the message, in order
+    vector<char *> blocks_;  // owned; staging blocks of the copied pieces
+    size_t used_;            // bytes used in the last block
+    size_t capacity_;        // bytes of the last block
+    size_t size_;            // bytes of the message
+    size_t head_;            // bytes of the text header, see end_head()
+
+    Gather() {
+        used_ = 0;
+        capacity_ = 0;
+        size_ = 0;
+        head_ = 0;
+    }
+
+    ~Gather() {
+        for (size_t i = 0; i < blocks_.size(); i++) delete[] blocks_[i];
+    }
+
+    /** Adds len bytes to the message. Long runs are referenced and must stay
+     *  valid and unchanged until the message is sent. */
+    Gather &c(const char *bytes, size_t len) {
+        if (len < GATHER_MIN_REF) return copy(bytes, len);
+        iovec v;
+        v.iov_base = (void *) bytes;
+        v.iov_len = len;
+        iov_.push_back(v);
+        size_ += len;
+        return *this;
+    }
+
+    /** Adds a copy of len bytes to the message */
+    Gather &copy(const char *bytes, size_t len) {
+        if (len == 0) return *this;
+        if (used_ + len > capacity_) {
+            capacity_ = len > GATHER_BLOCK ? len : GATHER_BLOCK;
+            blocks_.push_back(new char[capacity_]);
+            used_ = 0;
+        }
+        char *dst = blocks_.back() + used_;
+        memcpy(dst, bytes, len);
+        used_ += len;
+        size_ += len;
+        // extend the last piece when the copy follows it in the same block
+        if (!iov_.empty() && (char *) iov_.back().iov_base + iov_.back().iov_len == dst) {
+            iov_.back().iov_len += len;
+        } else {
+            iovec v;
+            v.iov_base = dst;
+            v.iov_len = len;
+            iov_.push_back(v);
+        }
+        return *this;
+    }
+
+    /** Adds a copy of the chars of a C string */
+    Gather &c(const char *str) { return copy(str, strlen(str)); }
+
+    Gather &c(String &s) { return copy(s.c_str(), s.size()); }
+
+    Gather &c(size_t v) { return c(std::to_string(v).c_str()); }
+
+    /** Adds zeros up to the next BIN_ALIGN boundary */
+    Gather &pad() {
+        static const char zeros[BIN_ALIGN] = {0};
+        return copy(zeros, (BIN_ALIGN - size_ % BIN_ALIGN) % BIN_ALIGN);
+    }
+
+    /** Marks the end of the text header: the bytes added so far are read
+     *  before the message is built, the rest while it is. A message that
+     *  never calls this is all header. */
+    void end_head() {
+        head_ = size_;
+    }
+
+    /** Returns the bytes of the text header */
+    size_t head() {
+        return head_ == 0 ? size_ : head_;
+    }
+
+    /** Copies the referenced pieces, the message then owns all its bytes */
+    void own() {
+        vector<iovec> pieces;
+        pieces.swap(iov_);
+        size_ = 0;
+        used_ = capacity_;  // start a new block
+        for (size_t i = 0; i < pieces.size(); i++) {
+            copy((const char *) pieces[i].iov_base, pieces[i].iov_len);
+        }
+    }
+
+    /** Returns the message as a String */
+    String *str() {
+        StrBuff s;
+        for (size_t i = 0; i < iov_.size(); i++) {
+            s.c((const char *) iov_[i].iov_base, iov_[i].iov_len);
+        }
+        return s.get();
+    }
+
+    /** Writes the message to fd, returns false on error */
+    bool write_to(int fd) {
+        size_t i = 0;
+        while (i < iov_.size()) {
+            size_t n = iov_.size() - i < IOV_MAX ? iov_.size() - i : IOV_MAX;
+            ssize_t wr = writev(fd, &iov_[i], n);
+            if (wr <= 0) return false;
+            // skip what was written, the last piece may be partly written
+            while (i < iov_.size() && (size_t) wr >= iov_[i].iov_len) {
+                wr -= iov_[i].iov_len;
+                i++;
+            }
+            if (wr > 0) {
+                iov_[i].iov_base = (char *) iov_[i].iov_base + wr;
+                iov_[i].iov_len -= wr;
+            }
+        }
+        return true;
+    }
+};
+
+/** The bytes of an incoming message, read in order. A read past the end
+ *  of the message or a broken connection sets failed_, the bytes read are
+ *  then undefined. */
+class Scatter : public Object {
+public:
+    size_t pos_;   // offset in the message of the next byte
+    bool failed_;  // did a read fail
+
+    Scatter() {
+        pos_ = 0;
+        failed_ = false;
+    }
+
+    /** Copies the next len bytes into dst */
+    virtual void read(char *dst, size_t len) = 0;
+
+    /** Skips the zeros written by Gather::pad() */
+    void skip_pad() {
+        char zeros[BIN_ALIGN];
+        read(zeros, (BIN_ALIGN - pos_ % BIN_ALIGN) % BIN_ALIGN);
+    }
+};
+
+/** Reads a message from memory, starting pos bytes into it; at most left
+ *  bytes are read from buf. */
+class BufScatter : public Scatter {
+public:
+    const char *buf_;  // external
+    size_t left_;      // bytes of buf that may still be read
+
+    BufScatter(const char *buf, size_t pos, size_t left = SIZE_MAX) {
+        buf_ = buf;
+        pos_ = pos;
+        left_ = left;
+    }
+
+    void read(char *dst, size_t len) {
+        if (failed_ || len > left_) {
+            failed_ = true;
+            return;
+        }
+        memcpy(dst, buf_, len);
+        buf_ += len;
+        pos_ += len;
+        left_ -= len;
+    }
+};
+
+/** Reads the end of a message from a connection, at most left bytes;
+ *  the first pos bytes of the message were read already. */
+class SockScatter : public Scatter {
+public:
+    int fd_;
+    size_t left_;  // bytes of the message still on the connection
+
+    SockScatter(int fd, size_t pos, size_t left) {
+        fd_ = fd;
+        pos_ = pos;
+        left_ = left;
+    }
+
+    void read(char *dst, size_t len) {
+        if (failed_ || len > left_) {
+            failed_ = true;
+            return;
+        }
+        left_ -= len;
+        pos_ += len;
+        while (len > 0) {
+            ssize_t rd = ::read(fd_, dst, len);
+            if (rd <= 0) {
+                failed_ = true;
+                return;
+            }
+            dst += rd;
+            len -= rd;
+        }
+    }
+
+    /** Drops the bytes of the message nobody read, returns false if the
+     *  message could not be read whole */
+    bool finish() {
+        char sink[256];
+        while (left_ > 0 && !failed_) {
+            read(sink, left_ < sizeof(sink) ? left_ : sizeof(sink));
+        }
+        return !failed_;
+    }
+};
@@ -8,9 +8,14 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include "serial.h"
+#include "thread.h"
 #include "../wrappers/string.h"
 #include <iostream>
+#include <deque>
+#include <vector>
 #include "../args.h"
 
 using namespace std;
@@ -23,26 +28,175 @@ class NodeInfo : public Object {
 public:
     unsigned id;
     sockaddr_in address;
+    int conn;  // connection messages to the node are sent on, -1 until the first one
+    Lock lock; // guards conn, held while a message is written on it
+
+    NodeInfo() {
+        id = 0;
+        conn = -1;
+    }
+};
+
+/** Matches any sender or id in NetworkIP::recv_m. */
+static const size_t ANY_ID = (size_t) -1;
+/** Number of message kinds, one queue each. */
+static const size_t MSG_KINDS = (size_t) MsgKind::Directory + 1;
+
+/**
+ * Handles some of the messages received by a NetworkIP, on its receiver
+ * thread.
+ */
+class MessageHandler {
+public:
+    virtual ~MessageHandler() {}
+
+    /** Returns true if msg was handled, it is then owned by the handler. */
+    virtual bool handle(Message *msg) = 0;
 };
 
 /**
  * IP based network communications layer. Each node has an index
  * between 0 and num_nodes-1. nodes directory is ordered by node
  * index. Each node has a socket and ip address.
+ *
+ * Once the nodes are registered, start() runs a receiver thread that reads
+ * every incoming message. Messages the handler takes are served on that
+ * thread, the others are queued by kind, in the order they arrived, until
+ * recv_m() asks for a message of that kind, sender and id. A message that
+ * arrives early, say a Status of the next phase, waits in its queue while
+ * the messages of the current one are read past it.
+ *
+ * Connections are long lived: a node connects to a peer the first time it
+ * sends to it and keeps the connection for all the following messages,
+ * each one framed by its length. Incoming connections are polled together
+ * with the listening socket.
+ *
+ * Each outgoing connection has a lock of its own, so a slow peer only
+ * holds up the messages sent to it. The receiver thread never writes:
+ * the answers a handler gives are posted to an outbox that a sender thread
+ * writes out, so a node always keeps reading while its peers write to it.
 */
 class NetworkIP {
 public:
     NodeInfo *nodes_;
+    size_t num_nodes_;         // number of entries of nodes_
     size_t this_node_;
     int sock_;
     sockaddr_in ip_;
+    vector<int> peers_;        // accepted connections
+    size_t next_peer_;         // peer read first by the next read_m_(), for fairness
+    int wake_[2];              // pipe written by stop() to interrupt the receiver
+    MessageHandler *handler_;  // external
+    std::thread receiver_;
+    bool receiving_;           // is the receiver thread running
+    std::thread sender_;       // writes out the outbox
+    bool sending_;             // is the sender thread running
+    deque<pair<size_t, Gather *>> outbox_; // owned; targets and messages to send
+    Lock outbox_lock_;         // guards outbox_ and sending_, notified when they change
+    deque<Message *> inbox_[MSG_KINDS]; // owned; messages not taken by the handler, by kind
+    Lock inbox_lock_;          // guards inbox_, notified when it grows
 
     ~NetworkIP() {
+        stop();
+        for (size_t i = 0; i < num_nodes_; i++) {
+            if (nodes_[i].conn >= 0) close(nodes_[i].conn);
+        }
+        for (size_t i = 0; i < peers_.size(); i++) close(peers_[i]);
         delete[] nodes_;
         close(sock_);
+        close(wake_[0]);
+        close(wake_[1]);
+        for (size_t k = 0; k < MSG_KINDS; k++) {
+            for (size_t i = 0; i < inbox_[k].size(); i++) delete inbox_[k][i];
+        }
+        for (size_t i = 0; i < outbox_.size(); i++) delete outbox_[i].second;
     }
 
-    NetworkIP() {}
+    NetworkIP() {
+        nodes_ = nullptr;
+        num_nodes_ = 0;
+        next_peer_ = 0;
+        handler_ = nullptr;
+        receiving_ = false;
+        sending_ = false;
+        assert(pipe(wake_) == 0);
+    }
+
+    /** Starts the receiver thread, handler may be nullptr. */
+    void start(MessageHandler *handler) {
+        handler_ = handler;
+        // messages that arrived during init
+        for (size_t k = 0; handler_ != nullptr && k < MSG_KINDS; k++) {
+            deque<Message *> &q = inbox_[k];
+            for (size_t i = 0; i < q.size();) {
+                if (handler_->handle(q[i])) q.erase(q.begin() + i);
+                else i++;
+            }
+        }
+        receiving_ = true;
+        receiver_ = std::thread([this] { this->receive_(); });
+        sending_ = true;
+        sender_ = std::thread([this] { this->send_outbox_(); });
+    }
+
+    /** Stops the receiver thread, incoming messages are no longer read, and
+     *  the sender thread once the outbox is written out. */
+    void stop() {
+        if (!receiving_) return;
+        assert(write(wake_[1], "x", 1) == 1);
+        receiver_.join();
+        inbox_lock_.lock();
+        receiving_ = false;
+        inbox_lock_.notify_all();
+        inbox_lock_.unlock();
+        outbox_lock_.lock();
+        sending_ = false;
+        outbox_lock_.notify_all();
+        outbox_lock_.unlock();
+        sender_.join();
+    }
+
+    /** Body of the receiver thread */
+    void receive_() {
+        while (true) {
+            Message *msg = read_m_();
+            if (msg == nullptr) return;
+            if (handler_ != nullptr && handler_->handle(msg)) continue;
+            inbox_lock_.lock();
+            inbox_[(size_t) msg->kind_].push_back(msg);
+            inbox_lock_.notify_all();
+            inbox_lock_.unlock();
+        }
+    }
+
+    /** Body of the sender thread */
+    void send_outbox_() {
+        outbox_lock_.lock();
+        while (true) {
+            if (outbox_.empty()) {
+                if (!sending_) break;
+                outbox_lock_.wait();
+                continue;
+            }
+            pair<size_t, Gather *> next = outbox_.front();
+            outbox_.pop_front();
+            outbox_lock_.unlock();
+            send_gather(next.first, *next.second);
+            delete next.second;
+            outbox_lock_.lock();
+        }
+        outbox_lock_.unlock();
+    }
+
+    /** Queues a gathered message for the sender thread to send to the
+     *  target node, without waiting; the message is now owned by the
+     *  network. This is how the receiver thread answers. */
+    void post_gather(size_t target, Gather *g) {
+        outbox_lock_.lock();
+        outbox_.push_back(make_pair(target, g));
+        outbox_lock_.notify_all();
+        outbox_lock_.unlock();
+    }
 
     /**
      *
@@ -61,19 +215,19 @@ public:
         init_sock_(port, server_adr);
         cout << "server set at: " << server_adr << endl;
         nodes_ = new NodeInfo[arg.num_nodes];
-
-        for (size_t i = 0; i < arg.num_nodes; ++i) nodes_[i].id = 0;
+        num_nodes_ = arg.num_nodes;
 
         nodes_[0].address = ip_;
         nodes_[0].id = 0;
 
         for (size_t i = 1; i < arg.num_nodes; i++) {
-            Register *msg = dynamic_cast<Register *>(recv_m());
+            Register *msg = dynamic_cast<Register *>(recv_m(MsgKind::Register));
             cout << "registered a node" << endl;
             nodes_[msg->sender_].id = msg->sender_;
             nodes_[msg->sender_].address.sin_family = AF_INET;
             nodes_[msg->sender_].address.sin_addr = msg->client.sin_addr;
-            nodes_[i].address.sin_port = htons(msg->port);
+            nodes_[msg->sender_].address.sin_port = htons(msg->port);
+            delete msg;
         }
         size_t *ports = new size_t[arg.num_nodes];
         String **addresses = new String *[arg.num_nodes];
@@ -87,8 +241,7 @@ public:
         for (size_t i = 1; i < arg.num_nodes; i++) {
             ipd.target_ = i;
             cout << "Server sending directory" << endl;
-            sleep(3);
-            send_m(&ipd);
+            send_m(&ipd); // the node listens since it registered
         }
 
     }
@@ -100,6 +253,7 @@ public:
         init_sock_(port, client_adr);
 
         nodes_ = new NodeInfo[1];
+        num_nodes_ = 1;
         nodes_[0].id = 0;
         nodes_[0].address.sin_family = AF_INET;
         nodes_[0].address.sin_port = htons(server_port);
@@ -107,12 +261,14 @@ public:
             assert(false && "Invalid server IP address format");
         }
 
-        Register msg(idx, port, ip_);
+        Register msg(idx, ntohs(ip_.sin_port), ip_);
         send_m(&msg);
-        Directory *ipd = dynamic_cast<Directory *>(recv_m());
+        // nodes that already have the directory may send before ours comes
+        Directory *ipd = dynamic_cast<Directory *>(recv_m(MsgKind::Directory));
 
         NodeInfo *nodes = new NodeInfo[ipd->nodes + 1];
-        nodes[0] = nodes_[0];
+        nodes[0].address = nodes_[0].address;
+        nodes[0].conn = nodes_[0].conn; // keeps the connection to the server
         for (size_t i = 0; i < ipd->nodes; i++) {
             nodes[i + 1].id = i + 1;
             nodes[i + 1].address.sin_family = AF_INET;
@@ -122,12 +278,13 @@ public:
             }
         }
 
-        //delete[] nodes_;
+        delete[] nodes_;
         nodes_ = nodes;
-        //delete ipd;
+        num_nodes_ = ipd->nodes + 1;
+        delete ipd;
     }
 
-    /** Create a socket and bind it. */
+    /** Create a socket and bind it, to a free port if port is 0. */
     void init_sock_(unsigned port, char *client_adr) {
         assert((sock_ = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
         int opt = 1;
@@ -138,15 +295,28 @@ public:
 
         ip_.sin_port = htons(port);
         assert(bind(sock_, (sockaddr * ) & ip_, sizeof(ip_)) >= 0);
+        socklen_t len = sizeof(ip_);
+        getsockname(sock_, (sockaddr *) &ip_, &len); // the port bound
 
         assert(listen(sock_, 100) >= 0);
     }
 
-    /** Based on the message target, creates new connection to the appropriate
-     * server and then serializes the message on the connection fd. **/
-    void send_m(Message *msg) {
-        NodeInfo &tgt = nodes_[msg->target_];
-        cout << "Sending Message to " << inet_ntoa(tgt.address.sin_addr) << endl;
+    /** Reads len bytes from fd, returns false on error or end of stream */
+    static bool read_all_(int fd, char *buf, size_t len) {
+        while (len > 0) {
+            ssize_t rd = read(fd, buf, len);
+            if (rd <= 0) return false;
+            buf += rd;
+            len -= rd;
+        }
+        return true;
+    }
+
+    /** Returns the connection to the given node, connecting on first use;
+     *  the node's lock is held */
+    int conn_(size_t target) {
+        NodeInfo &tgt = nodes_[target];
+        if (tgt.conn >= 0) return tgt.conn;
         int conn = socket(AF_INET, SOCK_STREAM, 0);
         assert(conn >= 0 && "Unable to create client socket");
 
@@ -154,36 +324,114 @@ public:
             cout << "Unable to connect to remote node" << endl;
             exit(-1);
         }
+        int opt = 1; // messages are sent whole, do not wait to fill a packet
+        setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(int));
+        tgt.conn = conn;
+        return conn;
+    }
 
+    /** Sends the message on the connection to its target, the DataFrame it
+     *  carries is written straight from its columns. **/
+    void send_m(Message *msg) {
+        Gather g;
+        msg->gather(g);
+        send_gather(msg->target_, g);
+    }
 
-        String *msg_ser = msg->serialize();
-        cout << "Message: " << msg_ser->cstr_ << endl;
-        char *buf = msg_ser->c_str();
-        size_t size = msg_ser->size();
-        send(conn, &size, sizeof(size_t), 0);
-        send(conn, buf, size, 0);
-        cout << "Sent Successful" << endl;
+    /** Sends a gathered message to the target node, waiting until it is
+     *  written. The frame starts with the size of the message and of its
+     *  text header. Only the connection to the target is locked. **/
+    void send_gather(size_t target, Gather &g) {
+        size_t sizes[2] = {g.size_, g.head()};
+        iovec prefix;
+        prefix.iov_base = sizes;
+        prefix.iov_len = sizeof(sizes);
+        g.iov_.insert(g.iov_.begin(), prefix);
+        Lock &lock = nodes_[target].lock;
+        lock.lock();
+        if (!g.write_to(conn_(target))) {
+            cout << "Unable to send to remote node" << endl;
+            exit(-1);
+        }
+        lock.unlock();
     }
 
-    /** Listens on the server socket. When a message becomes available, reads
-     * its data, deserialize it and return object. */
-    Message *recv_m() {
-        sockaddr_in sender;
-        socklen_t addrlen = sizeof(sender);
-        cout << "waiting for connection" << endl;
-        int req = accept(sock_, (sockaddr * ) & sender, &addrlen);
-        size_t size = 0;
-        if (read(req, &size, sizeof(size_t)) == 0) {
-            cout << "failed to read" << endl;
+    /** Returns the oldest message of the given kind from the given sender
+     *  and with the given id, either of which may be ANY_ID, waiting for one
+     *  if needed. Before start() it reads the socket itself and queues the
+     *  messages it is not looking for. Returns nullptr if the network stops
+     *  before such a message arrives. */
+    Message *recv_m(MsgKind kind, size_t sender = ANY_ID, size_t id = ANY_ID) {
+        deque<Message *> &q = inbox_[(size_t) kind];
+        inbox_lock_.lock();
+        while (true) {
+            for (size_t i = 0; i < q.size(); i++) {
+                if ((sender == ANY_ID || q[i]->sender_ == sender) &&
+                    (id == ANY_ID || q[i]->id_ == id)) {
+                    Message *msg = q[i];
+                    q.erase(q.begin() + i);
+                    inbox_lock_.unlock();
+                    return msg;
+                }
+            }
+            if (receiving_) {
+                inbox_lock_.wait();
+                continue;
+            }
+            Message *msg = read_m_(); // the receiver is not running
+            if (msg == nullptr) break;
+            inbox_[(size_t) msg->kind_].push_back(msg);
         }
-        char *buf = new char[size];
-        int rd = 0;
-        while (rd != size) {
-            rd += read(req, buf + rd, size - rd);
+        inbox_lock_.unlock();
+        return nullptr;
+    }
+
+    /** Waits for a message on any connection, accepting new connections
+     *  on the way. Returns the deserialized message, or nullptr once stop()
+     *  is called. A peer that closes its connection is forgotten. */
+    Message *read_m_() {
+        while (true) {
+            vector<pollfd> fds(2 + peers_.size());
+            fds[0].fd = wake_[0];
+            fds[1].fd = sock_;
+            for (size_t i = 0; i < peers_.size(); i++) fds[2 + i].fd = peers_[i];
+            for (size_t i = 0; i < fds.size(); i++) fds[i].events = POLLIN;
+            if (poll(fds.data(), fds.size(), -1) < 0) continue; // interrupted
+            if (fds[0].revents != 0) return nullptr;
+            size_t polled = fds.size() - 2;
+            if (fds[1].revents != 0) {
+                int req = accept(sock_, nullptr, nullptr);
+                if (req >= 0) peers_.push_back(req); // polled next time
+            }
+            for (size_t n = 0; n < polled; n++) {
+                size_t i = (next_peer_ + n) % polled;
+                if (fds[2 + i].revents == 0) continue;
+                next_peer_ = i + 1;
+                Message *msg = read_frame_(peers_[i]);
+                if (msg != nullptr) return msg;
+                close(peers_[i]);
+                peers_.erase(peers_.begin() + i);
+                break; // fds no longer lines up with peers_
+            }
         }
-        Message *msg;
+    }
 
-        cout << "Received: " << buf << endl;
+    /** Reads one length prefixed message from the connection, nullptr if the
+     *  connection was closed. */
+    Message *read_frame_(int req) {
+        size_t sizes[2] = {0, 0}; // message, text header
+        if (!read_all_(req, (char *) sizes, sizeof(sizes))) return nullptr;
+        char *buf = new char[sizes[1] + 1];
+        bool ok = sizes[1] > 0 && sizes[1] <= sizes[0] && read_all_(req, buf, sizes[1]);
+        if (!ok) {
+            cout << "failed to read" << endl;
+            delete[] buf;
+            return nullptr;
+        }
+        buf[sizes[1]] = 0;
+        // the rest of the message goes straight into the DataFrame it holds
+        SockScatter in(req, sizes[1], sizes[0] - sizes[1]);
+        Message *msg = nullptr;
         switch (buf[0]) {
             case '1': // Register
                 msg = new Register(buf);
@@ -192,13 +440,29 @@ public:
                 msg = new Ack(buf);
                 break;
             case '3': // Status
-                msg = new Status(buf);
+                msg = new Status(buf, &in);
                 break;
             case '4': // Directory
                 msg = new Directory(buf);
                 break;
+            case '5':
+                msg = new Put(buf, &in);
+                break;
+            case '6': // Get
+            case '7': // WaitAndGet
+            case '9': // Cancel
+                msg = new Get(buf);
+                break;
+            case '8':
+                msg = new Reply(buf, &in);
+                break;
+        }
+        delete[] buf;
+        if (!in.finish()) {
+            cout << "failed to read" << endl;
+            delete msg;
+            return nullptr;
         }
-
         return msg;
     }
 
@@ -7,14 +7,17 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include "../dataframe/dataframe.h"
+#include "../key/key.h"
+#include "gather.h"
 
 #include <iostream>
+#include <vector>
 
 using namespace std;
 
 enum class MsgKind {
     Ack, Nack, Put,
-    Reply, Get, WaitAndGet, Status,
+    Reply, Get, WaitAndGet, Cancel, Status,
     Kill, Register, Directory
 };
 
@@ -29,7 +32,20 @@ public:
      * Serializes this message to a String
      */
     virtual String *serialize() {
-        return nullptr;
+        Gather g;
+        gather(g);
+        return g.str();
+    }
+
+    /**
+     * Adds the pieces of this message to g, see Gather. Messages that carry
+     * a DataFrame are gathered without copying its columns; the others are
+     * just their serialization.
+     */
+    virtual void gather(Gather &g) {
+        String *s = serialize();
+        g.copy(s->c_str(), s->size());
+        delete s;
     }
 };
 
@@ -75,6 +91,87 @@ public:
 
 };
 
+/** Adds the binary encoding of df to g, which ends the text header of the
+ *  message: the number of columns and of rows, the type and length of each
+ *  column, then the encoding of each column (see Column::serialize). Every
+ *  field is a little-endian uint64, aligned on BIN_ALIGN bytes from the
+ *  start of the message. */
+void serialize_df(Gather &g, DataFrame *df) {
+    g.end_head();
+    g.pad();
+    uint64_t head[2] = {df->get_num_cols(), df->get_num_rows()};
+    g.copy((const char *) head, sizeof(head));
+    for (size_t i = 0; i < df->get_num_cols(); i++) {
+        uint64_t col[2] = {(uint64_t) df->columns[i]->get_type(), df->columns[i]->size()};
+        g.copy((const char *) col, sizeof(col));
+    }
+    for (size_t i = 0; i < df->get_num_cols(); i++) {
+        df->columns[i]->serialize(g);
+    }
+}
+
+/** Builds a DataFrame from the encoding written by serialize_df, the values
+ *  are read straight into the new columns. */
+DataFrame *deserialize_df(Scatter &in) {
+    in.skip_pad();
+    uint64_t head[2] = {0, 0};
+    in.read((char *) head, sizeof(head));
+    if (in.failed_) head[0] = 0;
+    vector<uint64_t> cols(2 * head[0]);
+    in.read((char *) cols.data(), cols.size() * sizeof(uint64_t));
+
+    DataFrame *d = new DataFrame(*new Schema());
+    for (size_t i = 0; i < head[0] && !in.failed_; i++) {
+        Column *c = nullptr;
+        switch ((char) cols[2 * i]) {
+            case 'F':
+                c = new FloatColumn();
+                break;
+            case 'S':
+                c = new StringColumn();
+                break;
+            case 'B':
+                c = new BoolColumn();
+                break;
+            case 'I':
+                c = new IntColumn();
+                break;
+            default:
+                in.failed_ = true;
+                return d;
+        }
+        c->deserialize(in, cols[2 * i + 1]);
+        d->add_column(c);
+    }
+    d->schema->nrow = head[1];
+    return d;
+}
+
+/** Builds a DataFrame from the rest of a message; it is read from in when
+ *  given, else from memory starting at rest, within the message buffer. */
+DataFrame *deserialize_df(char *buffer, char *rest, Scatter *in) {
+    if (in != nullptr) return deserialize_df(*in);
+    BufScatter buf(rest, rest - buffer);
+    return deserialize_df(buf);
+}
+
+/** Appends the sender, target and id of msg to g, each followed by a '?' */
+void serialize_header(Gather &g, Message *msg) {
+    g.c(msg->sender_).c("?").c(msg->target_).c("?").c(msg->id_).c("?");
+}
+
+/** Reads the kind, sender, target and id fields of a message into msg.
+ *  Returns the rest of the buffer. */
+char *deserialize_header(char *buffer, Message *msg) {
+    char *save;
+    strtok_r(buffer, "?", &save); // kind
+    msg->sender_ = atoi(strtok_r(nullptr, "?", &save));
+    msg->target_ = atoi(strtok_r(nullptr, "?", &save));
+    msg->id_ = atoi(strtok_r(nullptr, "?", &save));
+    return save;
+}
+
+/** A DataFrame sent to a node. */
 class Status : public Message {
 public:
     DataFrame *msg_; // owned
@@ -91,107 +188,125 @@ public:
         this->msg_ = msg;
     }
 
-    //Deserializing from a char*
-    Status(char *buffer) {
-        char **args = new char *[1000];
-        char *token = strtok(buffer, "?");
-        int k = 0;
-        while (token != NULL) {
-            args[k] = token;
-            k++;
-            token = strtok(NULL, "?");
-        }
+    /** Deserializes from the text header in buffer, the DataFrame is read
+     *  from in, or from the rest of buffer if in is nullptr */
+    Status(char *buffer, Scatter *in = nullptr) {
         this->kind_ = MsgKind::Status;
-        this->sender_ = atoi(args[1]);
-        this->target_ = atoi(args[2]);
-        this->id_ = atoi(args[3]);
+        this->msg_ = deserialize_df(buffer, deserialize_header(buffer, this), in);
+    }
 
-        char *recieved = args[4];
-        char **columns = new char *[1000];
-        size_t columns_size = 0;
-        int p = 0;
-        token = strtok(recieved, "!");
-        while (token != NULL) {
-            columns[p] = token;
-            columns_size++;
-            p++;
-            token = strtok(NULL, "!");
-        }
+    void gather(Gather &g) {
+        g.c("3?");
+        serialize_header(g, this);
+        serialize_df(g, msg_);
+    }
+};
 
-        DataFrame *d = new DataFrame(*new Schema());
-        for (int i = 0; i < columns_size; i++) {
-            Column *c;
-            char *column = columns[i];
-            token = strtok(column, "}");
-            switch (token[0]) {
-                case 'F':
-                    token = strtok(NULL, "}");
-                    c = new FloatColumn();
-                    while (token != NULL) {
-                        c->push_back((float) atof(token));
-                        token = strtok(NULL, "}");
-                    }
-                    break;
-                case 'S':
-                    token = strtok(NULL, "}");
-                    c = new StringColumn();
-                    while (token != NULL) {
-                        c->push_back(new String(token));
-                        token = strtok(NULL, "}");
-                    }
-                    break;
-                case 'B':
-                    token = strtok(NULL, "}");
-                    c = new BoolColumn();
-                    while (token != NULL) {
-                        c->push_back((bool) atoi(token));
-                        token = strtok(NULL, "}");
-                    }
-                    break;
-                case 'I':
-                    token = strtok(NULL, "}");
-                    c = new IntColumn();
-                    while (token != NULL) {
-                        c->push_back((int) atoi(token));
-                        token = strtok(NULL, "}");
-                    }
-                    break;
-            }
-            d->add_column(c);
-        }
+/** Asks the home node of key_ to store df_. */
+class Put : public Message {
+public:
+    Key *key_;       // owned
+    DataFrame *df_;  // owned
 
-        this->msg_ = d;
+    ~Put() {
+        delete key_;
+        delete df_;
+    }
 
+    Put(size_t sender, Key *key, DataFrame *df) {
+        this->kind_ = MsgKind::Put;
+        this->sender_ = sender;
+        this->target_ = key->home;
+        this->id_ = 0;
+        this->key_ = key->clone();
+        this->df_ = df;
     }
 
-    /**
-     * Serializes this Status to a String
-     */
-    String *serialize() {
-        StrBuff *s = new StrBuff();
-        char str[10000] = ""; /* In fact not necessary as snprintf() adds the
-                         0-terminator. */
-        snprintf(str, sizeof str, "3?");
-        s->c(str);
-        snprintf(str, sizeof this->sender_, "%zu", this->sender_);
-        s->c(str);
-        snprintf(str, sizeof str, "?");
-        s->c(str);
-        snprintf(str, sizeof this->target_, "%zu", this->target_);
-        s->c(str);
-        snprintf(str, sizeof str, "?");
-        s->c(str);
-        snprintf(str, sizeof this->target_, "%zu", this->id_);
-        s->c(str);
-        snprintf(str, sizeof str, "?");
-        s->c(str);
-        for (int i = 0; i < msg_->get_num_cols(); i++) {
-            snprintf(str, sizeof str, "%s", msg_->columns[i]->serialize()->cstr_);
-            s->c(str);
-        }
-        return s->get();
+    /** Deserializes like Status */
+    Put(char *buffer, Scatter *in = nullptr) {
+        this->kind_ = MsgKind::Put;
+        char *rest = deserialize_header(buffer, this);
+        char *save;
+        size_t home = atoi(strtok_r(rest, "?", &save));
+        this->key_ = new Key(new String(strtok_r(nullptr, "?", &save)), home);
+        this->df_ = deserialize_df(buffer, save, in);
+    }
+
+    void gather(Gather &g) {
+        g.c("5?");
+        serialize_header(g, this);
+        g.c(key_->home).c("?").c(*key_->name).c("?");
+        serialize_df(g, df_);
+    }
+};
+
+/** Asks the home node of key_ for its DataFrame. With the WaitAndGet kind
+ *  the home node replies once the key is there, with Get it replies at
+ *  once, with no DataFrame if the key is missing. With the Cancel kind it
+ *  withdraws the WaitAndGet of the same sender and id, which timed out. */
+class Get : public Message {
+public:
+    Key *key_;  // owned
+
+    ~Get() {
+        delete key_;
+    }
+
+    Get(MsgKind kind, size_t sender, Key *key, size_t id) {
+        this->kind_ = kind;
+        this->sender_ = sender;
+        this->target_ = key->home;
+        this->id_ = id;
+        this->key_ = key->clone();
     }
 
+    //Deserializing from a char*
+    Get(char *buffer) {
+        this->kind_ = buffer[0] == '7' ? MsgKind::WaitAndGet
+                    : buffer[0] == '9' ? MsgKind::Cancel : MsgKind::Get;
+        char *rest = deserialize_header(buffer, this);
+        char *save;
+        size_t home = atoi(strtok_r(rest, "?", &save));
+        this->key_ = new Key(new String(strtok_r(nullptr, "?", &save)), home);
+    }
+
+    void gather(Gather &g) {
+        g.c(kind_ == MsgKind::WaitAndGet ? "7?" : kind_ == MsgKind::Cancel ? "9?" : "6?");
+        serialize_header(g, this);
+        g.c(key_->home).c("?").c(*key_->name).c("?");
+    }
+};
+
+/** Answers the Get of the same id; df_ is nullptr if the key was missing. */
+class Reply : public Message {
+public:
+    DataFrame *df_;  // owned
+
+    ~Reply() {
+        delete df_;
+    }
+
+    Reply(size_t sender, size_t target, size_t id, DataFrame *df) {
+        this->kind_ = MsgKind::Reply;
+        this->sender_ = sender;
+        this->target_ = target;
+        this->id_ = id;
+        this->df_ = df;
+    }
+
+    /** Deserializes like Status */
+    Reply(char *buffer, Scatter *in = nullptr) {
+        this->kind_ = MsgKind::Reply;
+        char *rest = deserialize_header(buffer, this);
+        this->df_ = rest[0] == '0' ? nullptr : deserialize_df(buffer, rest + 1, in);
+    }
+
+    void gather(Gather &g) {
+        g.c("8?");
+        serialize_header(g, this);
+        g.c(df_ == nullptr ? "0" : "1"); // a missing key has no DataFrame
+        if (df_ != nullptr) serialize_df(g, df_);
+    }
 };
 
 class Register : public Message {
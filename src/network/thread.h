@@ -66,6 +66,12 @@ public:
      */
     void wait() { cv_.wait(mtx_); }
 
+    /** Like wait(), but gives up at the given deadline. Returns false if it
+     *  woke up because the deadline passed. */
+    bool wait_until(std::chrono::steady_clock::time_point deadline) {
+        return cv_.wait_until(mtx_, deadline) == std::cv_status::no_timeout;
+    }
+
     // Notify all threads waiting on this lock
     void notify_all() { cv_.notify_all(); }
 };
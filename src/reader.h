@@ -5,51 +5,90 @@
 #pragma once
 
 #include "dataframe/row.h"
+#include "rower.h"
 #include "SImap.h"
 
-class Reader {
+/** A Reader is a Rower whose work is done in visit(), so it can be given to
+ *  both DataFrame::map and DataFrame::pmap. */
+class Reader : public Rower {
 public:
     Reader() {
 
     }
 
     /** Reads from the given Row **/
-    virtual bool visit(Row &) {}
+    virtual bool visit(Row &) { return false; }
+
+    bool accept(Row &r) override { return visit(r); }
 };
 
+/** Counts the words of the rows it visits. Rows coming from a dictionary
+ *  encoded column carry a code per word; the map entry of each code is
+ *  remembered so that a word is only looked up in the map the first time it
+ *  is seen. */
 class Adder : public Reader {
 public:
-    SIMap &map_;  // String to Num map;  Num holds an int
-
-    Adder(SIMap &map) : map_(map) {}
-
-    /** Reads from the given Row and adds elements to map **/
-    bool visit(Row &r) override {
+    SIMap &map_;  // word to count map
+    SIMap *own_;  // owned; the map of a clone, nullptr for the original
+    size_t dict_;           // dictionary the cached codes belong to, 0 if none
+    vector<size_t> by_code_; // map entry of each code, SIMAP_EMPTY if unknown
+
+    Adder(SIMap &map) : map_(map) {
+        own_ = nullptr;
+        dict_ = 0;
+    }
 
-        if (r.size == 1) {
-            String *word = r.get_string(0);
-            assert(word != nullptr);
-
-            Num *num = map_.contains(*word) ? map_.get(*word) : new Num();
-            assert(num != nullptr);
-            num->v++;
-            map_.set(*word, num);
-            return false;
-        } else if (r.size > 1 && r.col_type(0) == 'S' && r.col_type(1) == 'I') {
+    /** Builds a clone counting into a map of its own */
+    Adder(SIMap *own) : map_(*own) {
+        own_ = own;
+        dict_ = 0;
+    }
 
-            String *word = r.get_string(0);
-            int count = r.get_int(1);
+    ~Adder() {
+        delete own_;
+    }
 
-            assert(word != nullptr);
+    /** The clone counts into its own map, merged by join_delete */
+    Rower *clone() override {
+        return new Adder(new SIMap());
+    }
 
-            Num *num = map_.contains(*word) ? map_.get(*word) : new Num();
+    /** Adds the counts of the other Adder to this one's */
+    void join_delete(Rower *other) override {
+        map_.merge(dynamic_cast<Adder *>(other)->map_);
+        delete other;
+    }
 
-            assert(num != nullptr);
-            num->v += count;
+    /** Returns the map entry counting the word of column 0 of the row */
+    size_t entry_(Row &r) {
+        int code = r.get_code(0);
+        if (code >= 0) {
+            if (r.get_dict(0) != dict_) {
+                dict_ = r.get_dict(0);
+                by_code_.clear();
+            }
+            if ((size_t) code < by_code_.size() && by_code_[code] != SIMAP_EMPTY) {
+                return by_code_[code];
+            }
+        }
+        String *word = r.get_string(0);
+        assert(word != nullptr);
+        size_t e = map_.upsert(word->c_str(), word->size(), word->hash());
+        if (code >= 0) {
+            if ((size_t) code >= by_code_.size()) by_code_.resize(code + 1, SIMAP_EMPTY);
+            by_code_[code] = e;
+        }
+        return e;
+    }
 
-            map_.set(*word, num);
-            return false;
+    /** Reads from the given Row and adds elements to map **/
+    bool visit(Row &r) override {
+        if (r.size == 1) {
+            map_.counts_[entry_(r)]++;
+        } else if (r.size > 1 && r.col_type(0) == 'S' && r.col_type(1) == 'I') {
+            map_.counts_[entry_(r)] += r.get_int(1);
         }
+        return false;
     }
 };
 
@@ -7,6 +7,8 @@
 #pragma once
 
 #include "dataframe/row.h"
+#include <thread>
+#include <vector>
 
 class Rower : public Object {
 public:
@@ -15,14 +17,34 @@ public:
         should not be retained as it is likely going to be reused in the next
         call. The return value is used in filters to indicate that a row
         should be kept. */
-    virtual bool accept(Row &r);
+    virtual bool accept(Row &r) { return false; }
 
     /** Once traversal of the data frame is complete the rowers that were
         split off will be joined.  There will be one join per split. The
         original object will be the last to be called join on. The join method
         is reponsible for cleaning up memory. */
-    void join_delete(Rower *other);
+    virtual void join_delete(Rower *other) { delete other; }
 
-    /** Return a copy of the object; nullptr is considered an error */
-    Rower *clone();
-};
\ No newline at end of file
+    /** Return a copy of the object to be run on another thread over a
+        different range of rows. A rower that returns nullptr cannot be
+        split, DataFrame::pmap then runs it on a single thread. */
+    virtual Rower *clone() { return nullptr; }
+};
+
+/** Joins rowers[1..] into rowers[0], in a tree: in round k every rower at
+ *  a multiple of 2^(k+1) joins the one 2^k after it, the joins of a round
+ *  running in parallel. A rower is only ever joined with the rowers that
+ *  follow it, rowers[0] last, so the result does not depend on timing. */
+static void joinTree(std::vector<Rower *> &rowers) {
+    size_t n = rowers.size();
+    for (size_t step = 1; step < n; step *= 2) {
+        std::vector<std::thread> joins;
+        for (size_t i = 2 * step; i + step < n; i += 2 * step) {
+            joins.push_back(std::thread(&Rower::join_delete, rowers[i], rowers[i + step]));
+        }
+        rowers[0]->join_delete(rowers[step]);
+        for (size_t i = 0; i < joins.size(); i++) {
+            joins[i].join();
+        }
+    }
+}
@@ -83,13 +83,46 @@ public:
 
     /** Compute a hash for this string. */
     size_t hash_me() {
+        return hash_chars(cstr_, size_);
+    }
+
+    /** The hash of len chars, the same as the hash of a String holding them. */
+    static size_t hash_chars(const char *cstr, size_t len) {
         size_t hash = 0;
-        for (size_t i = 0; i < size_; ++i)
-            hash = cstr_[i] + (hash << 6) + (hash << 16) - hash;
+        for (size_t i = 0; i < len; ++i)
+            hash = cstr[i] + (hash << 6) + (hash << 16) - hash;
         return hash;
     }
 };
 
+/** A String that can be pointed at characters it does not own, so a single
+ *  object can be reused as a view over many strings. The characters must
+ *  stay valid while they are viewed; the view never frees them.  */
+class MutableString : public String {
+public:
+    char *own_; // owned; the buffer of the constructor, freed by ~String
+
+    MutableString() : String("", 0) {
+        own_ = cstr_;
+    }
+
+    ~MutableString() {
+        cstr_ = own_;
+    }
+
+    /** Views the given zero terminated chars */
+    void become(const char *v) {
+        become(v, strlen(v), 0);
+    }
+
+    /** Views the len chars at v, whose hash is given; 0 means unknown */
+    void become(const char *v, size_t len, size_t hash) {
+        size_ = len;
+        cstr_ = (char *) v;
+        hash_ = hash;
+    }
+};
+
 /** A string buffer builds a string from various pieces.
  *  author: jv */
 class StrBuff : public Object {
@@ -135,6 +168,14 @@ public:
         return *this;
     }
 
+    /** Adds len bytes to this StrBuff, they may include zeros **/
+    StrBuff &c(const char *bytes, size_t len) {
+        grow_by_(len);
+        memcpy(val_ + size_, bytes, len);
+        size_ += len;
+        return *this;
+    }
+
     /** Adds the String to this StrBuff **/
     StrBuff &c(String &s) { return c(s.c_str()); }
 
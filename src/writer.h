@@ -12,6 +12,8 @@
 #include "dataframe/row.h"
 #include "args.h"
 #include "SImap.h"
+#include "mapped.h"
+#include "CS4500NE/scan.h"
 
 class Writer {
 public:
@@ -29,141 +31,149 @@ public:
 };
 
 
+/**
+ * Reads the words of a text file: the runs of letters and digits, a word
+ * ending at the first other character, which is skipped along with the
+ * whitespace after it (so two punctuation marks in a row make an empty
+ * word). The file is mapped, and word boundaries are found a block at a
+ * time from the class masks of scan.h: the end of a word is the first
+ * clear bit of the alnum mask, the end of whitespace the first clear bit
+ * of the space mask. Words are handed out as views into the mapping,
+ * lowercased into a buffer of the reader if asked.
+ */
 class FileReader : public Writer {
 public:
-    /** Reads next word and stores it in the row. Actually read the word.
-        While reading the word, we may have to re-fill the buffer  */
+    MappedFile *file_;   // owned
+    const char *start_;  // first byte of the range
+    const char *end_;    // end of the range
+    const char *p_;      // next byte to read
+    const char *blk_;    // block whose masks are cached, nullptr if none
+    ClassMasks masks_;   // masks of the block at blk_
+    bool lower_;         // are the words lowercased
+    char *word_;         // owned; the last word read when copied
+    size_t wordCap_;     // bytes allocated for word_
+
+    /** Reads next word and stores it in the row, which views a copy. */
     void visit(Row &r) override {
-        assert(i_ < end_);
-        assert(!isspace(buf_[i_]));
-        size_t wStart = i_;
-        while (true) {
-            if (i_ == end_) {
-                if (feof(file_)) {
-                    ++i_;
-                    break;
-                }
-                i_ = wStart;
-                wStart = 0;
-                fillBuffer_();
-            }
-            if (isspace(buf_[i_]) || !isalnum(buf_[i_])) break;
-            ++i_;
+        size_t len;
+        const char *chars = read_word_(len);
+        if (chars != word_) chars = copy_(chars, len, false);
+        r.set_view(0, chars, len, 0, -1, 0);
+    }
+
+    /** Calls f(chars, len) for each word left to read. The chars are not
+     *  zero terminated and only valid during the call; no word is copied
+     *  unless it is lowercased. */
+    template<class F>
+    void forEachWord(F f) {
+        while (!done()) {
+            size_t len;
+            const char *chars = read_word_(len);
+            f(chars, len);
         }
-        buf_[i_] = 0;
-        String *word = new String(buf_ + wStart, i_ - wStart);
-        r.set(0, word);
-        ++i_;
-        skipWhitespace_();
     }
 
-    /** Returns true when there are no more words to read.  There is nothing
-       more to read if we are at the end of the buffer and the file has
-       all been read.     */
+    /** Returns true when there are no more words to read. */
     bool done() override {
-        return (i_ >= end_) && feof(file_);
+        return p_ >= end_;
     }
 
     /** Creates the reader and opens the file for reading.  */
-    FileReader() {
-        file_ = fopen(arg.file, "r");
-        if (file_ == nullptr) cout << "Cannot open file " << arg.file << endl;
-        buf_ = new char[BUFSIZE + 1]; //  null terminator
-        fillBuffer_();
-        skipWhitespace_();
+    FileReader() : FileReader(arg.file, 0, SIZE_MAX) {}
+
+    /** Creates a reader of the bytes [start, end) of the file at path. The
+     *  words it reads are those a reader of the whole file would read there
+     *  when start follows a newline. Words are lowercased if lower is true. */
+    FileReader(const char *path, size_t start, size_t end, bool lower = false) {
+        file_ = new MappedFile(path);
+        if (end > file_->size()) end = file_->size();
+        if (start > end) start = end;
+        start_ = file_->data() + start;
+        end_ = file_->data() + end;
+        blk_ = nullptr;
+        lower_ = lower;
+        word_ = new char[wordCap_ = 64];
+        p_ = skip_(start_, false);
     }
 
-    static const size_t BUFSIZE = 1024;
+    ~FileReader() {
+        delete file_;
+        delete[] word_;
+    }
 
-    /** Reads more data from the file. */
-    void fillBuffer_() {
-        size_t start = 0;
-        // compact unprocessed stream
-        if (i_ != end_) {
-            start = end_ - i_;
-            memcpy(buf_, buf_ + i_, start);
+    /** Returns the next word and sets len to its length, then moves past
+     *  the character ending it and the whitespace after it. */
+    const char *read_word_(size_t &len) {
+        assert(p_ < end_);
+        const char *chars = p_;
+        const char *stop = skip_(p_, true);
+        len = stop - chars;
+        p_ = stop < end_ ? skip_(stop + 1, false) : end_;
+        return lower_ ? copy_(chars, len, true) : chars;
+    }
+
+    /** Copies len chars into word_, zero terminated, lowercased if lower */
+    const char *copy_(const char *chars, size_t len, bool lower) {
+        if (len >= wordCap_) {
+            delete[] word_;
+            word_ = new char[wordCap_ = len + 1];
+        }
+        for (size_t i = 0; i < len; i++) {
+            char c = chars[i];
+            word_[i] = lower && c >= 'A' && c <= 'Z' ? c | 0x20 : c;
         }
-        // read more contents
-        end_ = start + fread(buf_ + start, sizeof(char), BUFSIZE - start, file_);
-        i_ = start;
+        word_[len] = 0;
+        return word_;
     }
 
-    /** Skips spaces.  Note that this may need to fill the buffer if the
-        last character of the buffer is space itself.  */
-    void skipWhitespace_() {
-        while (true) {
-            if (i_ == end_) {
-                if (feof(file_)) return;
-                fillBuffer_();
+    /** Returns the first byte at or after p that is not a letter or digit
+     *  if alnum, not whitespace otherwise; end_ if there is none. Blocks
+     *  are aligned on the start of the range, the masks of the last one
+     *  visited are kept since a word and the whitespace after it are
+     *  usually found in the same block. */
+    const char *skip_(const char *p, bool alnum) {
+        while (p < end_) {
+            if (blk_ == nullptr || p < blk_ || p >= blk_ + SCAN_BLOCK) {
+                blk_ = p - (p - start_) % SCAN_BLOCK;
+                size_t left = end_ - blk_;
+                masks_ = left >= SCAN_BLOCK ? classMaskBlock(blk_) : classMaskScalar(blk_, left);
             }
-            // if the current character is not whitespace, we are done
-            if (!isspace(buf_[i_]))
-                return;
-            // otherwise skip it
-            ++i_;
+            uint32_t out = ~(alnum ? masks_.alnum : masks_.space) >> (p - blk_);
+            if (out != 0) {
+                const char *res = p + __builtin_ctz(out);
+                return res < end_ ? res : end_;
+            }
+            p = blk_ + SCAN_BLOCK;
         }
+        return end_;
     }
-
-    char *buf_;
-    size_t end_ = 0;
-    size_t i_ = 0;
-    FILE *file_;
 };
 
+/** Writes the words of an SIMap and their counts, one row per word. */
 class Summer : public Writer {
 public:
     SIMap &map_;
-    size_t i = 0;
-    size_t j = 0;
-    size_t seen = 0;
+    vector<size_t> *entries_ = nullptr; // external; the entries to visit, all if null
+    size_t i = 0;  // next entry of the map, or of entries_
 
     Summer(SIMap &map) : map_(map) {
     }
 
-    /** Progresses the map **/
-    void next() {
-        if (i == map_.capacity_) { return; }
-        else if (j < map_.items_[i].keys_.size()) {
-            j = j + 1;
-        } else {
-            i = i + 1;
-            j = 0;
-            while (i < map_.capacity_ && map_.items_[i].keys_.size() == 0 && k() == nullptr) {
-                i = i + 1;
-            }
-        }
-    }
-
-    /** Returns a Key name from the SIMap at the current i and j **/
-    String *k() {
-        if (i == map_.capacity_ || j == map_.items_[i].keys_.size()) return nullptr;
-        return (String *) (map_.items_[i].keys_.get_(j));
+    /** Visits only the given entries, see SIMap::partition() */
+    Summer(SIMap &map, vector<size_t> &entries) : map_(map), entries_(&entries) {
     }
 
-    /** Returns a value from the SIMap at the current i and j **/
-    size_t v() {
-        if (i == map_.capacity_ || j == map_.items_[i].keys_.size()) {
-            assert(false);
-            return 0;
-        }
-        return ((Num *) (map_.items_[i].vals_.get_(j)))->v;
-    }
-
-    /** Gets a String, Num pair from SIMap and stores them in the given Row */
+    /** Gets a word and its count from the SIMap and stores them in the
+     *  given Row, which views the word in the map */
     void visit(Row &r) override {
-        if (k() == nullptr) {
-            next();
-        }
-        String *key = k();
-        size_t value = v();
-        r.set(0, key);
-        r.set(1, (int) value);
-        seen++;
-        next();
+        size_t e = entries_ == nullptr ? i : (*entries_)[i];
+        r.set_view(0, map_.key(e), map_.key_len(e), map_.hashes_[e], -1, 0);
+        r.set(1, (int) map_.counts_[e]);
+        i++;
     }
 
-    /** Returns true when there are no more words String, Num pairs in SIMap */
-    bool done() override { return seen >= map_.size(); }
+    /** Returns true when there are no more words to visit */
+    bool done() override { return i >= (entries_ == nullptr ? map_.size() : entries_->size()); }
 };
 
 
@@ -7,6 +7,7 @@
 #include "../src/dataframe/schema.h"
 
 #include "../src/CS4500NE/parser.h"
+#include "../src/dataframe/snapshot.h"
 
 #include "../src/key/kvstore.h"
 #include "../src/key/key.h"
@@ -28,12 +29,25 @@
 
 #include <string.h>
 
+Args arg;
+
 char* cwc_strdup(const char* src) {
     char* result = new char[strlen(src) + 1];
     strcpy(result, src);
     return result;
 }
 
+/** Creates an empty file of a name no other run of the tests uses, for
+ *  tests that write one; returns its path, which the caller deletes. */
+char* tempFile(const char* prefix) {
+    char* path = new char[strlen(prefix) + 13];
+    sprintf(path, "/tmp/%s-XXXXXX", prefix);
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    return path;
+}
+
 void test_stringColumn() {
     Provider::StringColumn* col = new Provider::StringColumn();
     // Basic tests
@@ -127,6 +141,190 @@ void test_strSlice() {
     assert(slice5.toInt() == 4378);
 }
 
+/** The SIMD delimiter masks agree with the scalar one, and a line longer than a block
+ *  splits into the same fields. */
+void testScan() {
+    char block[SCAN_BLOCK];
+    for (size_t i = 0; i < SCAN_BLOCK; i++) block[i] = "<a>\" 1"[i % 6];
+    assert(delimMaskBlock(block) == delimMaskScalar(block, SCAN_BLOCK));
+#ifdef SCAN_X86
+    assert(delimMaskSSE2(block) == delimMaskScalar(block, SCAN_BLOCK));
+#endif
+    const char* line = "<12> <\"a > quoted string longer than a block\"> <-3> < 1 >";
+    size_t len = strlen(line);
+    vector<size_t> delims;
+    forEachDelim(line, len, [&](size_t pos, char c) { delims.push_back(pos); });
+    vector<size_t> expected;
+    for (size_t i = 0; i < len; i++) {
+        if (line[i] == '<' || line[i] == '>' || line[i] == '"') expected.push_back(i);
+    }
+    assert(delims == expected);
+    SorParser parser(line, 0, len, len);
+    assert(parser._scanLine(line, len, ParserMode::DETECT_NUM_COLUMNS) == 4);
+}
+
+/** The words of text as FileReader read it one byte at a time with isspace and isalnum. */
+vector<string> wordsOf(const string& text) {
+    vector<string> words;
+    size_t i = 0, n = text.size();
+    while (i < n && isspace((unsigned char)text[i])) i++;
+    while (i < n) {
+        size_t start = i;
+        while (i < n && isalnum((unsigned char)text[i])) i++;
+        words.push_back(text.substr(start, i - start));
+        i++;
+        while (i < n && isspace((unsigned char)text[i])) i++;
+    }
+    return words;
+}
+
+/** Word boundaries found a block at a time are those of the byte by byte reader, across
+ *  blocks, empty words and bytes above 127 included. */
+void testWords() {
+    char block[SCAN_BLOCK];
+    for (size_t i = 0; i < SCAN_BLOCK; i++) block[i] = "aZ0 \t\r,@[`{\xe9\v9"[i % 14];
+    ClassMasks scalar = classMaskScalar(block, SCAN_BLOCK);
+    assert(classMaskBlock(block).alnum == scalar.alnum);
+    assert(classMaskBlock(block).space == scalar.space);
+#ifdef SCAN_X86
+    assert(classMaskSSE2(block).alnum == scalar.alnum);
+    assert(classMaskSSE2(block).space == scalar.space);
+#endif
+
+    string text = "  Hello, world!! A-b\tc\r\nd\xe9t\xe9 ";
+    for (int i = 0; i < 200; i++) {
+        text += string(i % 37 + 1, 'a' + i % 26) + " ,.\n\t"[i % 5] + (i % 7 == 0 ? "?!" : "");
+    }
+    text += "last";
+    char* path = tempFile("eau2-words-test");
+    FILE* f = fopen(path, "wb");
+    fwrite(text.data(), 1, text.size(), f);
+    fclose(f);
+    vector<string> expected = wordsOf(text);
+    vector<string> words;
+    FileReader whole(path, 0, SIZE_MAX);
+    whole.forEachWord([&](const char* chars, size_t len) { words.push_back(string(chars, len)); });
+    assert(words == expected);
+    assert(words[0] == "Hello" && words[2] == "" && words.back() == "last");
+
+    FileReader lower(path, 0, SIZE_MAX, true);
+    Schema ws("S");
+    Row word(&ws);
+    lower.visit(word);
+    assert(strcmp(word.get_string(0)->c_str(), "hello") == 0);
+    remove(path);
+    delete[] path;
+}
+
+/** Parses a mapped file in ranges cut in the middle of lines, the rows must be those of
+ *  a single parser. */
+void testParseRanges() {
+    char* path = tempFile("eau2-parse-test");
+    FILE* f = fopen(path, "wb");
+    for (int i = 0; i < 1000; i++) {
+        fprintf(f, "<%d> <%s> <%d.5>\n", i, i % 3 == 0 ? "a longer field" : "b", i);
+    }
+    fclose(f);
+    DataFrame* one = parseSorFile(path, 1);
+    DataFrame* many = parseSorFile(path, 7, 100);
+    assert(one->get_num_rows() == 1000);
+    assert(many->get_num_rows() == 1000);
+    for (size_t i = 0; i < 1000; i++) {
+        assert(many->get_int(0, i) == one->get_int(0, i));
+        assert(strcmp(many->get_string(1, i), one->get_string(1, i)) == 0);
+        assert(many->get_float(2, i) == one->get_float(2, i));
+    }
+    // the parts of a file hold its rows once, in order
+    size_t next = 0;
+    for (size_t i = 0; i < 3; i++) {
+        DataFrame* part = parseSorPart(path, i, 3, 1);
+        for (size_t r = 0; r < part->get_num_rows(); r++) {
+            assert(part->get_int(0, r) == (int)next++);
+        }
+        delete part;
+    }
+    assert(next == 1000);
+    delete one;
+    delete many;
+
+    // so do the words of a file read in parts
+    FileReader whole(path, 0, SIZE_MAX);
+    Schema ws("S");
+    Row word(&ws);
+    vector<string> words;
+    while (!whole.done()) {
+        whole.visit(word);
+        words.push_back(word.get_string(0)->c_str());
+    }
+    MappedFile mapped(path);
+    size_t w = 0;
+    for (size_t i = 0; i < 4; i++) {
+        size_t start, end;
+        mapped.part(i, 4, start, end);
+        FileReader fr(path, start, end);
+        fr.forEachWord([&](const char* chars, size_t len) {
+            assert(words[w++] == string(chars, len));
+        });
+    }
+    assert(w == words.size());
+    remove(path);
+    delete[] path;
+
+    // a range that is not aligned drops its partial first and last lines
+    const char* text = "ab\ncd\nef";
+    LineReader r(text, 1, 7, 8);
+    size_t len;
+    const char* line = r.readLine(len);
+    assert(len == 2 && strncmp(line, "cd", 2) == 0);
+    assert(r.readLine(len) == nullptr);
+    LineReader all(text, 0, 8, 8);
+    all.readLine(len);
+    all.readLine(len);
+    line = all.readLine(len);
+    assert(len == 2 && strncmp(line, "ef", 2) == 0);
+}
+
+/** A snapshot reloads the parsed frame, and is ignored once the source or
+ *  the snapshot itself changes. */
+void testSnapshot() {
+    char* path = tempFile("eau2-snapshot-test");
+    string snapshot = string(path) + ".snap"; // where loadSorFile writes it
+    const char* snap = snapshot.c_str();
+    FILE* f = fopen(path, "wb");
+    for (int i = 0; i < 300; i++) fprintf(f, "<%d> <\"%s\"> <%d.25> <%d>\n", i, i % 3 ? "ab" : "xyz", i, i % 2);
+    fclose(f);
+    remove(snap);
+    delete loadSorFile(path, 1); // snapshots are opt-in
+    assert(access(snap, F_OK) != 0);
+    DataFrame* parsed = loadSorFile(path, 1, true);
+    struct stat source;
+    stat(path, &source);
+    DataFrame* mapped = readSnapshot(snap, source);
+    assert(mapped != nullptr);
+    assert(mapped->get_num_rows() == 300 && mapped->get_num_cols() == 4);
+    for (size_t i = 0; i < 300; i++) {
+        assert(mapped->get_int(0, i) == parsed->get_int(0, i));
+        assert(strcmp(mapped->get_string(1, i), parsed->get_string(1, i)) == 0);
+        assert(mapped->get_float(2, i) == parsed->get_float(2, i));
+        assert(mapped->get_bool(3, i) == parsed->get_bool(3, i));
+    }
+    delete mapped;
+
+    // a flipped byte in the body fails the hash
+    FILE* s = fopen(snap, "r+b");
+    fseek(s, sizeof(SnapshotHeader) + 40, SEEK_SET);
+    fputc(0x7f, s);
+    fclose(s);
+    assert(readSnapshot(snap, source) == nullptr);
+    // a source of another size does not match
+    source.st_size++;
+    assert(readSnapshot(snap, source) == nullptr);
+    delete parsed;
+    remove(snap);
+    remove(path);
+    delete[] path;
+}
+
 void test_serialization() {
     DataFrame* d = new DataFrame(*new Schema("BFIS"));
     d->columns[0]->push_back((bool)1);
@@ -134,35 +332,44 @@ void test_serialization() {
     d->columns[2]->push_back((int)3);
     d->columns[3]->push_back(new String("h"));
     d->columns[0]->push_back((bool)0);
-    d->columns[1]->push_back((float)4.0);
-    d->columns[2]->push_back((int)6);
-    d->columns[3]->push_back(new String("f"));
+    d->columns[1]->push_back((float)4.1);
+    d->columns[2]->push_back((int)-6);
+    d->columns[3]->push_back(new String("f}!?"));
+    d->schema->nrow = 2;
     Status* s = new Status(0, 0, d);
     char* serialized = s->serialize()->cstr_;
-    assert(strcmp(serialized, "3?0?0?0?B}1}0}!F}3.000000}4.000000}!I}3}6}!S}h}f}!") == 0);
+    assert(strncmp(serialized, "3?0?0?0?", 8) == 0);
 
     Status* s2 = new Status(serialized);
     assert(0 == s2->sender_);
     assert(0 == s2->target_);
     assert(0 == s2->id_);
-//    for (int i = 0; i < s2->msg_->get_num_cols(); i++) {
-//        for (int j = 0; j < s2->msg_->columns[i]->size(); j++) {
-//            switch (s2->msg_->columns[i]->get_type()) {
-//                case 'F':
-//                    cout << *s2->msg_->columns[i]->as_float()->get(j);
-//                    break;
-//                case 'S':
-//                    cout << *s2->msg_->columns[i]->as_string()->get(j)->cstr_;
-//                    break;
-//                case 'B':
-//                    cout << *s2->msg_->columns[i]->as_bool()->get(j);
-//                    break;
-//                case 'I':
-//                    cout << *s2->msg_->columns[i]->as_int()->get(j);
-//                    break;
-//            }
-//        }
-//    }
+    DataFrame* d2 = s2->msg_;
+    assert(d2->get_num_rows() == 2 && d2->get_num_cols() == 4);
+    assert(d2->get_bool(0, 0) && !d2->get_bool(0, 1));
+    assert(d2->get_float(1, 0) == 3.0f && d2->get_float(1, 1) == 4.1f);
+    assert(d2->get_int(2, 0) == 3 && d2->get_int(2, 1) == -6);
+    assert(strcmp(d2->get_string(3, 0), "h") == 0);
+    assert(strcmp(d2->get_string(3, 1), "f}!?") == 0);
+
+    // frames are exact whatever their size
+    DataFrame* big = new DataFrame(*new Schema("IBS"));
+    for (int i = 0; i < 100000; i++) {
+        big->columns[0]->push_back(i);
+        big->columns[1]->push_back((bool)(i % 3 == 0));
+        String str("wwwwwww", 1 + i % 7);
+        big->columns[2]->push_back(&str);
+    }
+    big->schema->nrow = 100000;
+    Status* b = new Status(1, 2, big);
+    String* ser = b->serialize();
+    char* buf = new char[ser->size()];
+    memcpy(buf, ser->c_str(), ser->size());
+    Status* b2 = new Status(buf);
+    assert(b2->msg_->get_num_rows() == 100000);
+    assert(b2->msg_->get_int(0, 99999) == 99999);
+    assert(b2->msg_->get_bool(1, 99999) && !b2->msg_->get_bool(1, 99998));
+    assert(b2->msg_->columns[2]->as_string()->length(99999) == 1 + 99999 % 7);
 }
 
 void serial2() {
@@ -184,6 +391,65 @@ void serial2() {
     assert(strcmp(d->serialize()->cstr_,c->serialize()->cstr_) == 0);
 }
 
+void serialKV() {
+    DataFrame* d = new DataFrame(*new Schema("IS"));
+    d->columns[0]->push_back((int)7);
+    d->columns[1]->push_back(new String("seven"));
+    d->schema->nrow = 1;
+    Key k("chunk-3", 2);
+    Put* p = new Put(1, &k, d);
+    assert(p->target_ == 2);
+    Put* p2 = new Put(p->serialize()->cstr_);
+    assert(p2->key_->home == 2 && p2->key_->equals(&k));
+    String* ps = p->serialize();
+    String* ps2 = p2->serialize();
+    assert(ps->size() == ps2->size() && memcmp(ps->c_str(), ps2->c_str(), ps->size()) == 0);
+
+    Get* g = new Get(MsgKind::WaitAndGet, 1, &k, 42);
+    Get* g2 = new Get(g->serialize()->cstr_);
+    assert(g2->kind_ == MsgKind::WaitAndGet && g2->id_ == 42 && g2->sender_ == 1);
+    assert(g2->key_->equals(&k) && g2->target_ == 2);
+
+    Reply* r = new Reply(2, 1, 42, p2->df_);
+    Reply* r2 = new Reply(r->serialize()->cstr_);
+    assert(r2->id_ == 42 && r2->df_->get_int(0, 0) == 7);
+    assert(strcmp(r2->df_->get_string(1, 0), "seven") == 0);
+    r->df_ = nullptr;
+    Reply* missing = new Reply(2, 1, 43, nullptr);
+    assert((new Reply(missing->serialize()->cstr_))->df_ == nullptr);
+}
+
+/** Messages wait in the queue of their kind until asked for by sender and id */
+void testInbox() {
+    size_t nodes = arg.num_nodes;
+    arg.num_nodes = 1;
+    NetworkIP net;
+    net.server_init(0, 0, (char*) "127.0.0.1"); // any free port
+    arg.num_nodes = nodes;
+    net.start(nullptr);
+    for (size_t stage = 0; stage < 2; stage++) {
+        for (size_t sender = 1; sender <= 2; sender++) {
+            DataFrame* d = new DataFrame(*new Schema("I"));
+            d->columns[0]->push_back((int)(10 * stage + sender));
+            d->schema->nrow = 1;
+            Status st(sender, 0, d);
+            st.id_ = stage;
+            net.send_m(&st);
+        }
+    }
+    Ack ack(2, 0);
+    net.send_m(&ack);
+    Message* a = net.recv_m(MsgKind::Ack);
+    assert(a->sender_ == 2);
+    Status* s = dynamic_cast<Status*>(net.recv_m(MsgKind::Status, 2, 1));
+    assert(s->msg_->get_int(0, 0) == 12);
+    s = dynamic_cast<Status*>(net.recv_m(MsgKind::Status, ANY_ID, 1));
+    assert(s->msg_->get_int(0, 0) == 11);
+    s = dynamic_cast<Status*>(net.recv_m(MsgKind::Status));
+    assert(s->msg_->get_int(0, 0) == 1);
+    net.stop();
+}
+
 void testDf() {
     Schema* s = new Schema("IBSF");
     DataFrame* dataFrame = new DataFrame(*s);
@@ -224,6 +490,295 @@ void testDf() {
 
 }
 
+void testColumns() {
+    IntColumn* ic = new IntColumn();
+    FloatColumn* fc = new FloatColumn();
+    BoolColumn* bc = new BoolColumn();
+    for (int i = 0; i < 1000; i++) {
+        ic->push_back(i);
+        fc->push_back((float)i / 2);
+        bc->push_back(i % 3 == 0);
+    }
+    bc->appendMissing();
+    assert(ic->size() == 1000);
+    assert(bc->size() == 1001);
+    assert(ic->get(999) == 999);
+    assert(fc->get(7) == 3.5);
+    assert(bc->get(999) && !bc->get(998) && !bc->get(1000));
+    ic->set(3, -3);
+    bc->set(64, true);
+    bc->set(63, false);
+    assert(ic->get(3) == -3);
+    assert(bc->get(64) && !bc->get(63) && bc->get(66));
+    delete ic;
+    delete fc;
+    delete bc;
+}
+
+void testChunks() {
+    size_t rows = SEGMENT_SIZE * 2 + 10;
+    DataFrame* df = new DataFrame(*new Schema("IB"));
+    for (size_t i = 0; i < rows; i++) {
+        df->columns[0]->push_back((int)i);
+        df->columns[1]->push_back(i % 2 == 0);
+    }
+    arg.rows_per_chunk = SEGMENT_SIZE;
+    assert(df->num_chunks() == 3);
+    DataFrame* c1 = df->chunk(1);
+    DataFrame* c2 = df->chunk(2);
+    assert(c1->get_num_rows() == SEGMENT_SIZE);
+    assert(c2->get_num_rows() == 10);
+    // aligned chunks share the segments of the original frame
+    assert(c1->columns[0]->as_int()->vals_.dir_[0] == df->columns[0]->as_int()->vals_.dir_[1]);
+    assert(c1->get_int(0, 5) == SEGMENT_SIZE + 5);
+    assert(c2->get_bool(1, 4) && !c2->get_bool(1, 5));
+    // writing to a shared segment copies it
+    c1->set(0, 5, 0);
+    assert(c1->get_int(0, 5) == 0);
+    assert(df->get_int(0, SEGMENT_SIZE + 5) == SEGMENT_SIZE + 5);
+
+    DataFrame* all = new DataFrame(*new Schema("IB"));
+    all->append_chunk(df->chunk(0));
+    all->append_chunk(c1);
+    all->append_chunk(c2);
+    assert(all->get_num_rows() == rows);
+    assert(all->get_int(0, rows - 1) == rows - 1);
+    assert(all->get_int(0, SEGMENT_SIZE + 5) == 0);
+
+    arg.rows_per_chunk = 7;
+    DataFrame* c3 = df->chunk(3);
+    assert(c3->get_num_rows() == 7);
+    assert(c3->get_int(0, 6) == 27);
+    assert(!c3->get_bool(1, 0) && c3->get_bool(1, 1));
+    arg.rows_per_chunk = SEGMENT_SIZE;
+    delete c3;
+    delete all;
+    delete df;
+}
+
+void testStrings() {
+    StringColumn* col = new StringColumn();
+    String* hi = new String("hi");
+    col->push_back(hi);
+    delete hi; // the column keeps its own copy
+    col->push_back("world!", 5);
+    col->appendMissing();
+    assert(strcmp(col->get(0), "hi") == 0 && col->length(0) == 2);
+    assert(strcmp(col->get(1), "world") == 0 && col->length(1) == 5);
+    assert(col->length(2) == 0);
+    assert(col->code(0) == -1);
+
+    // encoding keeps the values and stores each distinct one once
+    col->encode();
+    for (size_t i = 0; i < 1000; i++) col->push_back(i % 2 == 0 ? "hi" : "bye", i % 2 == 0 ? 2 : 3);
+    assert(col->size() == 1003);
+    assert(col->dict_size() == 4);
+    assert(col->code(3) == col->code(0) && col->code(4) != col->code(0));
+    assert(strcmp(col->get(1002), "bye") == 0);
+    String bye("bye");
+    assert(col->hash(4) == bye.hash());
+
+    // rows read from an encoded column carry the codes
+    DataFrame* df = new DataFrame(*new Schema("S"));
+    df->encode_strings();
+    df->columns[0]->append(col, 0, col->size());
+    df->get_schema()->nrow = col->size();
+    Row row(df->get_schema());
+    df->fill_row(4, row);
+    assert(row.get_string(0)->equals(&bye));
+    assert(row.get_code(0) == df->columns[0]->as_string()->code(4));
+    SIMap map;
+    Adder add(map);
+    df->map(&add);
+    assert(map.get(bye) == 500);
+    delete df;
+    delete col;
+}
+
+/** Checks that map hands out the same row, filled with each row in turn */
+class RowChecker : public Reader {
+public:
+    Row* first_ = nullptr;
+    size_t seen_ = 0;
+
+    bool visit(Row& r) override {
+        if (first_ == nullptr) first_ = &r;
+        assert(first_ == &r);
+        assert(r.get_idx() == seen_ && r.get_int(0) == (int)seen_);
+        assert(r.get_string(1)->size() == seen_ % 3);
+        seen_++;
+        return false;
+    }
+};
+
+void testMap() {
+    DataFrame* df = new DataFrame(*new Schema("IS"));
+    const char* strs[] = {"", "a", "bb"};
+    for (int i = 0; i < 100; i++) {
+        df->columns[0]->push_back(i);
+        df->columns[1]->as_string()->push_back(strs[i % 3], i % 3);
+    }
+    RowChecker rc;
+    df->map(&rc);
+    assert(rc.seen_ == 100);
+
+    // a row can own a string or view one, and switch between the two
+    Row r(df->get_schema());
+    r.set(1, new String("owned"));
+    String owned("owned");
+    assert(r.get_string(1)->equals(&owned));
+    r.set_view(1, "view", 4, 0, -1, 0);
+    assert(strcmp(r.get_string(1)->c_str(), "view") == 0);
+    assert(r.get_string(1)->hash() == String("view").hash());
+    delete df;
+}
+
+/** Remembers the rows it saw, a join must bring the rows that follow. */
+class RangeRower : public Rower {
+public:
+    size_t first_, last_;  // rows seen, last_ excluded
+
+    RangeRower() : first_(SIZE_MAX), last_(SIZE_MAX) {}
+
+    bool accept(Row &r) {
+        if (first_ == SIZE_MAX) first_ = last_ = r.get_idx();
+        assert(r.get_idx() == last_);
+        last_++;
+        return false;
+    }
+
+    void join_delete(Rower *other) {
+        RangeRower *o = dynamic_cast<RangeRower *>(other);
+        assert(o->first_ == last_);
+        last_ = o->last_;
+        delete o;
+    }
+
+    Rower *clone() { return new RangeRower(); }
+};
+
+void testPmap() {
+    size_t rows = PMAP_MIN_ROWS * 4 + 3;
+    DataFrame* df = new DataFrame(*new Schema("SI"));
+    const char* words[] = {"a", "b", "c", "d", "e"};
+    for (size_t i = 0; i < rows; i++) {
+        df->columns[0]->as_string()->push_back(words[i % 5], 1);
+        df->columns[1]->push_back((int)(i % 7));
+    }
+    size_t threads = arg.threads;
+    arg.threads = 4;
+    SIMap seq, par;
+    Adder add_seq(seq), add_par(par);
+    df->map(&add_seq);
+    df->pmap(add_par);
+    assert(par.size() == 5);
+    for (size_t i = 0; i < 5; i++) {
+        String w(words[i]);
+        assert(par.get(w) == seq.get(w));
+    }
+
+    // every row whose user is tagged tags its project
+    Set users(7), projects(rows);
+    users.set(3);
+    ProjectsTagger tagger(users, projects, rows);
+    DataFrame* commits = new DataFrame(*new Schema("II"));
+    for (size_t i = 0; i < rows; i++) {
+        commits->columns[0]->push_back((int)i);
+        commits->columns[1]->push_back((int)(i % 7));
+    }
+    commits->pmap(tagger);
+    assert(tagger.newProjects.num_true() == (rows + 3) / 7);
+    assert(tagger.newProjects.test(rows - 1) == ((rows - 1) % 7 == 3));
+
+    // an odd number of ranges is joined in order too
+    arg.threads = 3;
+    RangeRower ranges;
+    commits->pmap(ranges);
+    assert(ranges.first_ == 0 && ranges.last_ == rows);
+    arg.threads = threads;
+    delete commits;
+    delete df;
+}
+
+/** Counts survive the table growing, and merging adds them up. */
+void testSIMap() {
+    SIMap a, b;
+    char word[16];
+    for (size_t i = 0; i < 1000; i++) {
+        size_t len = snprintf(word, sizeof(word), "w%zu", i % 300);
+        a.increment(word, len, String::hash_chars(word, len));
+    }
+    assert(a.size() == 300);
+    String w7("w7"), none("none");
+    assert(a.get(w7) == 4 && a.get(none) == 0);
+    assert(a.find("none", 4, none.hash()) == SIMAP_EMPTY);
+    b.increment("w7", 2, w7.hash(), 10);
+    b.increment("new", 3, String("new").hash());
+    b.merge(a);
+    assert(b.size() == 301 && b.get(w7) == 14);
+    assert(strcmp(b.key(0), "w7") == 0 && b.key_len(1) == 3);
+
+    // every key lands in exactly one partition, with its count
+    SIMap parts[3];
+    vector<vector<size_t>> entries;
+    b.partition(3, entries);
+    size_t total = 0;
+    for (size_t k = 0; k < 3; k++) {
+        parts[k].merge_entries(b, entries[k]);
+        total += parts[k].size();
+        Summer sum(b, entries[k]);
+        size_t visited = 0;
+        for (; !sum.done(); sum.i++) visited++;
+        assert(visited == parts[k].size());
+    }
+    assert(total == b.size());
+    assert(parts[SIMap::bucket(w7.hash(), 3)].get(w7) == 14);
+}
+
+/** Word-wise set operations keep the bits past the size clear. */
+void testSet() {
+    Set a(130), b(200);
+    for (size_t i = 0; i < 200; i += 3) b.set(i);
+    a.set(1);
+    a.set(64);
+    a.set(129);
+    a.union_(b);
+    assert(a.num_true() == 2 + 44);  // 0, 3, ..., 129 plus 1 and 64
+    assert(a.test(64) && a.test(129) && !a.test(128));
+    assert(a.next(0) == 0 && a.next(1) == 1 && a.next(2) == 3 && a.next(130) == 130);
+    Set c(130);
+    c.set(64);
+    c.set(65);
+    a.intersect_(c);
+    assert(a.num_true() == 1 && a.next(0) == 64);
+    a.difference_(c);
+    assert(a.num_true() == 0 && a.next(0) == 130);
+
+    // sparse sets travel as varint lists, dense ones as bitmaps
+    Set sparse(100000), dense(100000);
+    sparse.set(0);
+    sparse.set(5);
+    sparse.set(99999);
+    for (size_t i = 1000; i < 3000; i += 2) dense.set(i);
+    DataFrame* sp = SetCodec::encode(sparse);
+    DataFrame* de = SetCodec::encode(dense);
+    assert(sp->get_int(0, 0) == SetCodec::VARINT && sp->get_num_rows() < 8);
+    assert(de->get_int(0, 0) == SetCodec::BITMAP);
+    Set back(100000);
+    back.set(7);
+    SetCodec::decode_into(sp, back);
+    SetCodec::decode_into(de, back);
+    assert(back.num_true() == 3 + 1000 + 1);
+    assert(back.test(99999) && back.test(2998) && !back.test(2999) && back.test(7));
+    delete sp;
+    delete de;
+    Set none(10);
+    DataFrame* empty = SetCodec::encode(none);
+    SetCodec::decode_into(empty, none);
+    assert(none.num_true() == 0);
+    delete empty;
+}
+
 void testKV() {
     size_t SZ = 1000*1000;
     double* vals = new double[SZ];
@@ -237,6 +792,132 @@ void testKV() {
     assert(sum==0);
 }
 
+void testKVKeys() {
+    KVStore kv;
+    size_t n = 2000;
+    for (size_t i = 0; i < n; i++) {
+        Key k(StrBuff("k-").c(i).get());
+        DataFrame* df = new DataFrame(*new Schema("I"));
+        df->columns[0]->push_back((int)i);
+        kv.put(&k, df);
+    }
+    assert(kv.size == n);
+    for (size_t i = 0; i < n; i++) {
+        Key k(StrBuff("k-").c(i).get());
+        assert(kv.get(k)->get_int(0, 0) == (int)i);
+    }
+    // replacing a value deletes the previous one
+    Key k7("k-7");
+    kv.put(&k7, new DataFrame(*new Schema("I")));
+    assert(kv.size == n && kv.get(k7)->get_num_rows() == 0);
+    // erased keys are gone, the others are still found
+    for (size_t i = 0; i < n; i += 2) {
+        Key k(StrBuff("k-").c(i).get());
+        kv.erase(k);
+        assert(kv.get(k) == nullptr);
+    }
+    assert(kv.size == n / 2);
+    for (size_t i = 1; i < n; i += 2) {
+        Key k(StrBuff("k-").c(i).get());
+        assert(kv.get(k) != nullptr);
+    }
+}
+
+/** Puts a one row frame under the keys w-0 to w-<n-1>, in reverse order */
+class LatePutter : public Thread {
+public:
+    KVStore& kv_;
+    size_t n_;
+
+    LatePutter(KVStore& kv, size_t n) : kv_(kv), n_(n) {}
+
+    void run() override {
+        for (size_t i = n_; i > 0; i--) {
+            sleep(5);
+            DataFrame* df = new DataFrame(*new Schema("I"));
+            df->columns[0]->push_back((int)(i - 1));
+            Key k(StrBuff("w-").c(i - 1).get());
+            kv_.put(&k, df);
+        }
+    }
+};
+
+void testWaitAndGet() {
+    KVStore kv;
+    Key missing("missing");
+    assert(kv.waitAndGet(missing, 10) == nullptr);
+
+    vector<Key*> keys;
+    for (size_t i = 0; i < 3; i++) keys.push_back(new Key(StrBuff("w-").c(i).get()));
+    vector<Key*> pending(keys);
+    LatePutter putter(kv, keys.size());
+    putter.start();
+    // values are consumed in the order they are put
+    for (int expected = 2; expected >= 0; expected--) {
+        size_t which;
+        DataFrame* df = kv.waitAndGetAny(pending, which);
+        assert(df->get_int(0, 0) == expected);
+        pending.erase(pending.begin() + which);
+    }
+    putter.join();
+    assert(kv.waitAndGet(*keys[1], 10)->get_int(0, 0) == 1);
+    for (size_t i = 0; i < 3; i++) delete keys[i];
+}
+
+/** Returns a port of the loopback that is free now, for a server that
+ *  others must know the port of before it starts. */
+unsigned freePort() {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in ip = {};
+    ip.sin_family = AF_INET;
+    ip.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(bind(sock, (sockaddr*)&ip, sizeof(ip)) == 0);
+    socklen_t len = sizeof(ip);
+    getsockname(sock, (sockaddr*)&ip, &len);
+    close(sock);
+    return ntohs(ip.sin_port);
+}
+
+/** Two stores of a two node network in one process. A fetched copy stays
+ *  valid until erased, and a timed out waitAndGet leaves no waiter behind. */
+void testRemoteKV() {
+    size_t nodes = arg.num_nodes;
+    arg.num_nodes = 2;
+    NetworkIP net0, net1;
+    unsigned port = freePort();
+    std::thread server([&net0, port] { net0.server_init(0, port, (char*) "127.0.0.1"); });
+    usleep(200 * 1000); // until node 0 listens
+    net1.client_init(1, 0, (char*) "127.0.0.1", port, (char*) "127.0.0.1");
+    server.join();
+    arg.num_nodes = nodes;
+    KVStore kv0, kv1;
+    kv0.connect(&net0);
+    kv1.connect(&net1);
+
+    Key key((char*) "remote", 0);
+    assert(kv1.waitAndGet(key, 20) == nullptr);
+    for (int i = 0; i < 100; i++) { // the Cancel is served on node 0's receiver
+        kv0.lock_.lock();
+        size_t waiting = kv0.waiters_.size();
+        kv0.lock_.unlock();
+        if (waiting == 0) break;
+        usleep(10 * 1000);
+    }
+    assert(kv0.waiters_.empty());
+
+    DataFrame* df = new DataFrame(*new Schema("I"));
+    df->columns[0]->push_back(5);
+    df->schema->nrow = 1;
+    kv0.put(&key, df);
+    DataFrame* copy = kv1.get(key);
+    assert(copy->get_int(0, 0) == 5);
+    assert(kv1.waitAndGet(key) == copy);  // served from the copy
+    kv1.erase(key);
+    assert(kv1.get(key)->get_int(0, 0) == 5);
+    net0.stop();
+    net1.stop();
+}
+
 int main(int argc, char* argv[]) {
     (void)argc;
     (void)argv;
@@ -246,16 +927,32 @@ int main(int argc, char* argv[]) {
     test_floatColumn();
     test_boolColumn();
     test_strSlice();
+    testScan();
+    testParseRanges();
+    testWords();
+    testSnapshot();
     printf("PASS\n");
     printf("Running Serialization Tests:");
     test_serialization();
     serial2();
+    serialKV();
+    testInbox();
     printf("PASS\n");
     printf("Running Dataframe Tests:");
     testDf();
+    testColumns();
+    testChunks();
+    testStrings();
+    testMap();
+    testPmap();
+    testSIMap();
+    testSet();
     printf("PASS\n");
     printf("Running KV Tests:");
     testKV();
+    testKVKeys();
+    testWaitAndGet();
+    testRemoteKV();
     printf("PASS\n");
     printf("TESTING COMPLETE\n");
     return 0;